@@ -12,22 +12,62 @@
 #include "MyWEBserver.h"
 #include "BreakPoint.h"
 #include "WDT.h";
+#include "Profiler.h"
+#include "Telemetry.h"
+#include "Supervisor.h"
+#include "Monitor.h"
 
 TaskHandle_t Core_Zero;
 
-const int CR0_ciMainTimer =  1000;
+#define CR0_CYCLES_PER_MICROSECOND 240  // @ 240mHz clock each ccount tick is ~4nS
 
-unsigned char CR0_ucMainTimerCaseCore0;
+const int CR0_ciStatsWindow = 1000;     //ticks (1mS each) per CPU utilization window
 
 unsigned int uiTestCounter;
 
-uint32_t CR0_u32Now;
-uint32_t CR0_u32Last;
-uint32_t CR0_u32Temp;
-uint32_t CR0_u32Avg;
+unsigned long CR0_ulTick;
+boolean CR0_btPrintTaskStats = false;   //print the task table stats every stats window
 
-unsigned long CR0_ulPreviousMicrosCore0;
-unsigned long CR0_ulCurrentMicrosCore0;
+//Core 0 task table entry
+//a task runs on every tick where (tick - phase) is a multiple of its period
+//tasks due on the same tick run in priority order, 0 first
+struct CR0_Task
+{
+  const char *strName;
+  void (*vfFunction)(void);
+  unsigned int uiPeriod;        //ticks
+  unsigned int uiPhase;         //ticks
+  unsigned char ucPriority;
+  uint32_t u32Budget;           //cycles, longer runs are counted as overruns
+
+  uint32_t u32Runs;             //runs this stats window
+  uint32_t u32Cycles;           //cycles used this stats window
+  uint32_t u32Overruns;         //runs over budget since boot
+  unsigned int uiUtilization;   //CPU utilization over the last stats window, tenths of a percent
+  unsigned char ucProfileStage; //execution time profile stage, see "Profiler.h"
+};
+
+void CR0_TelemetryTask();
+void CR0_BreakPointTask();
+void CR0_WebSocketTask();
+void CR0_WatchDogCheckTask();
+void CR0_StatsTask();
+void CR0_MonitorTask();
+
+CR0_Task CR0_Tasks[] =
+{
+  //name          function                period  phase  priority  budget
+  {"Telemetry",   CR0_TelemetryTask,      10,     0,     1,        100 * CR0_CYCLES_PER_MICROSECOND},
+  {"BreakPoint",  CR0_BreakPointTask,     25,     1,     1,        500 * CR0_CYCLES_PER_MICROSECOND},   //flushes the samples at 40 Hz
+  {"WebSocket",   CR0_WebSocketTask,      10,     2,     0,        2000 * CR0_CYCLES_PER_MICROSECOND},
+  {"WatchDog",    CR0_WatchDogCheckTask,  10,     4,     2,        200 * CR0_CYCLES_PER_MICROSECOND},
+  {"Stats",       CR0_StatsTask,          CR0_ciStatsWindow, 7, 3, 200 * CR0_CYCLES_PER_MICROSECOND},
+  {"Monitor",     CR0_MonitorTask,        CR0_ciStatsWindow, 9, 4, 1000 * CR0_CYCLES_PER_MICROSECOND},
+};
+
+const unsigned char CR0_ucNumTasks = sizeof(CR0_Tasks) / sizeof(CR0_Task);
+
+unsigned char CR0_ucTaskOrder[sizeof(CR0_Tasks) / sizeof(CR0_Task)];   //task table indexes sorted by priority
 
 void Core_ZeroCode( void * pvParameters );
 
@@ -46,6 +86,112 @@ void Core_ZEROInit()
 };
 
 
+//register each task with the profiler and sort the task table indexes by priority, only done once so a simple insertion sort is fine
+void CR0_InitTasks()
+{
+  for (unsigned char ucI = 0; ucI < CR0_ucNumTasks; ucI++)
+  {
+    CR0_Tasks[ucI].ucProfileStage = PRF_Register(CR0_Tasks[ucI].strName);
+    WDT_pstrCaseNameCore0[ucI] = CR0_Tasks[ucI].strName;
+
+    unsigned char ucJ = ucI;
+    while ((ucJ > 0) && (CR0_Tasks[CR0_ucTaskOrder[ucJ - 1]].ucPriority > CR0_Tasks[ucI].ucPriority))
+    {
+      CR0_ucTaskOrder[ucJ] = CR0_ucTaskOrder[ucJ - 1];
+      ucJ--;
+    }
+    CR0_ucTaskOrder[ucJ] = ucI;
+  }
+}
+
+//run a task and account its execution time against its budget
+void CR0_RunTask(CR0_Task *ptTask)
+{
+  uint32_t u32Start;
+  uint32_t u32End;
+
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Start)); // @ 240mHz clock each tick is ~4nS
+  ptTask->vfFunction();
+  asm volatile("esync; rsr %0,ccount":"=a" (u32End));
+
+  u32End = u32End - u32Start;
+  ptTask->u32Runs++;
+  ptTask->u32Cycles += u32End;
+  if (u32End > ptTask->u32Budget)
+  {
+    ptTask->u32Overruns++;
+  }
+  PRF_Record(ptTask->ucProfileStage, u32End);
+}
+
+//pick up the control loop snapshots from core 1 and sample the watch variables from each one
+void CR0_TelemetryTask()
+{
+  while (TEL_Receive())
+  {
+    WSVR_Sample(TEL_u32Time);
+  }
+}
+
+void CR0_BreakPointTask()
+{
+  uiTestCounter = uiTestCounter + 1;
+  WSVR_BreakPoint(1);
+}
+
+//web page control
+void CR0_WebSocketTask()
+{
+  webSocket.loop();
+}
+
+//warning exceed wdt time, and report the deadline supervisor cutting the motors
+void CR0_WatchDogCheckTask()
+{
+  WDT_CheckOperationTime();
+  SUP_Check();
+}
+
+//work out each task's CPU utilization over the last stats window, print the execution time profile when 'p' is sent over serial
+//and the watch variable sample benchmark for 'b'
+void CR0_StatsTask()
+{
+  if (Serial.available())
+  {
+    switch (Serial.read())
+    {
+      case 'p':
+        PRF_Print();
+        break;
+      case 'b':   //watch variable sample benchmark, see "BreakPoint.h"
+        WSVR_Benchmark();
+        break;
+    }
+  }
+
+  const uint32_t u32WindowCycles = CR0_ciStatsWindow * 1000UL * CR0_CYCLES_PER_MICROSECOND;
+
+  for (unsigned char ucIndex = 0; ucIndex < CR0_ucNumTasks; ucIndex++)
+  {
+    CR0_Task *ptTask = &CR0_Tasks[ucIndex];
+
+    ptTask->uiUtilization = ((uint64_t)ptTask->u32Cycles * 1000) / u32WindowCycles;
+    if (CR0_btPrintTaskStats)
+    {
+      Serial.printf("Core 0 %-10s runs %4u  cpu %3u.%u%%  overruns %u\n", ptTask->strName, ptTask->u32Runs,
+                    ptTask->uiUtilization / 10, ptTask->uiUtilization % 10, ptTask->u32Overruns);
+    }
+    ptTask->u32Runs = 0;
+    ptTask->u32Cycles = 0;
+  }
+}
+
+//stack high water marks and heap fragmentation, see "Monitor.h"
+void CR0_MonitorTask()
+{
+  MON_Sample();
+}
+
 void Core_ZeroCode( void * pvParameters )
 {
   Serial.print("Core - ");
@@ -63,6 +209,7 @@ void Core_ZeroCode( void * pvParameters )
 
 
   WDT_EnableFastWatchDogCore0();
+  SUP_Init();   //supervisor interrupt on core 0, so it still runs if the control task on core 1 hangs
 
   WDT_ResetCore0();
   WDT_vfFastWDTWarningCore0[0] = 0;
@@ -79,113 +226,29 @@ void Core_ZeroCode( void * pvParameters )
   WDT_vfFastWDTWarningCore0[9] = 0;
   WDT_ResetCore0();
 
-  ENC_Init();
+  CR0_InitTasks();
+
   //loop function for core 0
   //-------------------------------------------------------------------------------------------
+  TickType_t xLastWakeTime = xTaskGetTickCount();
   for (;;)
   {
+    //block until the next tick, the idle time goes back to the FreeRTOS idle task
+    vTaskDelayUntil(&xLastWakeTime, 1);
+    CR0_ulTick++;
 
+    WDT_ResetCore0();
 
-    CR0_ulCurrentMicrosCore0 = micros();
-    if ((CR0_ulCurrentMicrosCore0 - CR0_ulPreviousMicrosCore0) >= CR0_ciMainTimer)
+    for (unsigned char ucOrder = 0; ucOrder < CR0_ucNumTasks; ucOrder++)
     {
+      unsigned char ucIndex = CR0_ucTaskOrder[ucOrder];
+      CR0_Task *ptTask = &CR0_Tasks[ucIndex];
 
-      WDT_ResetCore0();
-      WDT_ucCaseIndexCore0 = CR0_ucMainTimerCaseCore0;
-      vTaskDelay(1);
-
-
-      CR0_ulPreviousMicrosCore0 = CR0_ulCurrentMicrosCore0;
-
-
-      switch (CR0_ucMainTimerCaseCore0) //full switch run through is 1mS
+      if (((CR0_ulTick - ptTask->uiPhase) % ptTask->uiPeriod) == 0)
       {
-        //###############################################################################
-        case 0:
-          {
-
-            CR0_ucMainTimerCaseCore0 = 1;
-
-            break;
-          }
-        //###############################################################################
-        case 1: //
-          {
-
-            uiTestCounter = uiTestCounter + 1;
-            //Serial.println(uiTestCounter);
-            WSVR_BreakPoint(1);
-            CR0_ucMainTimerCaseCore0 = 2;
-
-            break;
-          }
-        //###############################################################################
-        case 2: //web page control
-          {
-            asm volatile("esync; rsr %0,ccount":"=a" (CR0_u32Last)); // @ 240mHz clock each tick is ~4nS
-            webSocket.loop();
-            asm volatile("esync; rsr %0,ccount":"=a" (CR0_u32Now));
-
-            CR0_ucMainTimerCaseCore0 = 3;
-            break;
-          }
-        //###############################################################################
-        case 3:
-          {
-
-
-            CR0_ucMainTimerCaseCore0 = 4;
-            break;
-          }
-        //###############################################################################
-        case 4:   ///warning exceed wdt time
-          {
-            WDT_CheckOperationTime();
-            CR0_ucMainTimerCaseCore0 = 5;
-            break;
-          }
-        //###############################################################################
-        case 5:
-          {
-
-
-            CR0_ucMainTimerCaseCore0 = 6;
-            break;
-          }
-        //###############################################################################
-        case 6:
-          {
-
-
-            CR0_ucMainTimerCaseCore0 = 7;
-            break;
-          }
-        //###############################################################################
-        case 7:
-          {
-
-            CR0_ucMainTimerCaseCore0 = 8;
-            break;
-          }
-        //###############################################################################
-        case 8:
-          {
-
-            CR0_ucMainTimerCaseCore0 = 9;
-            break;
-          }
-        //###############################################################################
-        case 9:
-          {
-
-
-            CR0_ucMainTimerCaseCore0 = 0;
-
-            break;
-          }
-
+        WDT_ucCaseIndexCore0 = ucIndex;
+        CR0_RunTask(ptTask);
       }
-
     }
   }
 }
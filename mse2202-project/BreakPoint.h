@@ -10,6 +10,37 @@
   #define WATCH_VARIABLE_1_TYPE " put variable type ie unsigned int, boolean, float etc
   #define WATCH_VARIABLE_1 Variable name , not in quotes, if the variable is not a global ie local a temporary global variable will have to be used and the local variable will have to be passed in code to this
                                                                                         Temp variable before call to break point function. see under //temporary variable for local variable watching
+  control variables from core 1 are watched through their TEL_ mirrors in "Telemetry.h"
+
+  the names message ("L" request) is the schema, sent once: after the names "TYP;" lists each variable's type code, the
+  DataView getter the web page reads it with (u, i or f, then the size in bytes, ie "u4", "i2", "f4")
+  the values are sent as binary frames, little endian like the ESP32, no text formatting or String building per pass
+  byte 0     WSVR_FRAME_DATA
+  byte 1     break point halted at (1 to 4), 0 running
+  byte 2-3   uint16 sequence number, the web page counts the gaps as lost frames
+  byte 4-7   uint32 millis when the values were read
+  byte 8-    the watch variables in order, packed with no padding
+
+  sampling
+  running continuously, WSVR_Sample packs the watch variables into a RAM ring for every control loop snapshot that arrives
+  from core 1, at most one sample per WSVR_uiSamplePeriod mS ("R<mS>" from the web page, 1 samples every control loop pass)
+  the break point task flushes the ring as a few large frames instead of one small frame per value update
+  byte 0     WSVR_FRAME_SAMPLES
+  byte 1     number of samples in the frame
+  byte 2-3   uint16 sequence number
+  byte 4-7   uint32 millis of the first sample
+  byte 8-    the first sample, the watch variables packed as above, so each frame decodes on its own
+  then       every later sample as a delta against the one before it, see "WatchDelta.h"
+  between control loop passes most variables don't change, so a sample is a few bytes where the old "V#^" text message was
+  50 to 70 characters, WSVR_Benchmark prints the bytes actually sent per sample
+  halted at a break point the ring isn't filled, the single WSVR_FRAME_DATA frame is sent instead
+
+  nothing here allocates after boot, the names message is written in place into WSVR_cVariableNames by the WSVR_Format
+  functions (no String, no printf), the frames and the sample ring are fixed arrays
+  send 'b' over serial for WSVR_Benchmark: cycles to pack a sample, build the frames and the names message, and the heap
+  blocks and bytes allocated across them (heap_caps_get_info before and after, the websocket send left out)
+  it also reports the live check: every WSVR_HEAP_CHECK_FLUSHES flushes the heap is read around the real frame builds of
+  that flush and the next sample packed, and the changes are summed, so a steady state allocation shows up while streaming
 */
 
 #ifndef BREAKPOINT_H
@@ -24,34 +55,34 @@
 //
 #define WATCH_VARIABLE_2_NAME "Error1"
 #define WATCH_VARIABLE_2_TYPE int
-#define WATCH_VARIABLE_2 error1
+#define WATCH_VARIABLE_2 TEL_iError1
 ////
 #define WATCH_VARIABLE_3_NAME "ENC_vi32RightOdometer"
-#define WATCH_VARIABLE_3_TYPE volatile int32_t
-#define WATCH_VARIABLE_3 ENC_vi32RightOdometer
+#define WATCH_VARIABLE_3_TYPE int32_t
+#define WATCH_VARIABLE_3 TEL_i32RightOdometer
 //
 #define WATCH_VARIABLE_4_NAME "ENC_vi32LeftOdometer"
-#define WATCH_VARIABLE_4_TYPE volatile int32_t
-#define WATCH_VARIABLE_4 ENC_vi32LeftOdometer
+#define WATCH_VARIABLE_4_TYPE int32_t
+#define WATCH_VARIABLE_4 TEL_i32LeftOdometer
 
 ////-----------------------------------------------------------
 ////Row 2
 
 #define WATCH_VARIABLE_5_NAME "ENC_vui16LeftEncoderAMissed"
-#define WATCH_VARIABLE_5_TYPE volatile uint16_t
-#define WATCH_VARIABLE_5 ENC_vui16LeftEncoderAMissed
+#define WATCH_VARIABLE_5_TYPE uint16_t
+#define WATCH_VARIABLE_5 TEL_ui16LeftEncoderAMissed
 
 #define WATCH_VARIABLE_6_NAME "ENC_vui16LeftEncoderBMissed"
-#define WATCH_VARIABLE_6_TYPE  volatile uint16_t
-#define WATCH_VARIABLE_6 ENC_vui16LeftEncoderBMissed
+#define WATCH_VARIABLE_6_TYPE  uint16_t
+#define WATCH_VARIABLE_6 TEL_ui16LeftEncoderBMissed
 
 #define WATCH_VARIABLE_7_NAME "ENC_vui16RightEncoderAMissed"
-#define WATCH_VARIABLE_7_TYPE  volatile uint16_t
-#define WATCH_VARIABLE_7 ENC_vui16RightEncoderAMissed
+#define WATCH_VARIABLE_7_TYPE  uint16_t
+#define WATCH_VARIABLE_7 TEL_ui16RightEncoderAMissed
 
 #define WATCH_VARIABLE_8_NAME "ENC_vui16RightEncoderBMissed"
-#define WATCH_VARIABLE_8_TYPE  volatile uint16_t
-#define WATCH_VARIABLE_8 ENC_vui16RightEncoderBMissed
+#define WATCH_VARIABLE_8_TYPE  uint16_t
+#define WATCH_VARIABLE_8 TEL_ui16RightEncoderBMissed
 
 ////-----------------------------------------------------------
 ////Row 3
@@ -59,11 +90,11 @@
 
 #define WATCH_VARIABLE_9_NAME "ENC_ui32LeftEncoderAveTime;LL1;8000;UL1;400000" //only 6 charting varable allowed, first number is minimun value ; 2nd is maximum value
 #define WATCH_VARIABLE_9_TYPE uint32_t
-#define WATCH_VARIABLE_9 ENC_ui32LeftEncoderAveTime
+#define WATCH_VARIABLE_9 TEL_u32LeftEncoderAveTime
 
 #define WATCH_VARIABLE_10_NAME "ENC_ui32RightEncoderAveTime;LL2;8000;UL2;400000" //only 6 charting varable allowed, first number is minimun value ; 2nd is maximum value
 #define WATCH_VARIABLE_10_TYPE uint32_t
-#define WATCH_VARIABLE_10 ENC_ui32RightEncoderAveTime
+#define WATCH_VARIABLE_10 TEL_u32RightEncoderAveTime
 
 //#define WATCH_VARIABLE_11_NAME ""
 //#define WATCH_VARIABLE_11_TYPE int32_t
@@ -113,6 +144,16 @@
 
 
 #include "MyWEBserver.h"
+#include "WatchDelta.h"
+#include <type_traits>
+
+#define WSVR_FRAME_DATA 1
+#define WSVR_FRAME_SAMPLES 2
+#define WSVR_FRAME_HEADER 8
+#define WSVR_MAX_FRAME 1400                 //a batch fits in one TCP segment
+#define WSVR_SAMPLE_RING 64                 //samples, power of 2, 64 mS at the 1 mS control rate
+#define WSVR_SAMPLE_PERIOD 1                //mS between samples at boot, 1 for every control loop pass
+#define WSVR_HEAP_CHECK_FLUSHES 64          //flushes between live heap checks, heap_caps_get_info walks the whole heap
 
 //temporary variable for local variable watching
 unsigned int BP_uiTempVariable1;
@@ -179,171 +220,706 @@ extern WATCH_VARIABLE_19_TYPE WATCH_VARIABLE_19;
 extern WATCH_VARIABLE_20_TYPE WATCH_VARIABLE_20;
 #endif
 
+//bytes of one packed sample
+const size_t WSVR_uiSampleSize = 0
+#ifdef WATCH_VARIABLE_1_NAME
+                                     + sizeof(WATCH_VARIABLE_1)
+#endif
+#ifdef WATCH_VARIABLE_2_NAME
+                                     + sizeof(WATCH_VARIABLE_2)
+#endif
+#ifdef WATCH_VARIABLE_3_NAME
+                                     + sizeof(WATCH_VARIABLE_3)
+#endif
+#ifdef WATCH_VARIABLE_4_NAME
+                                     + sizeof(WATCH_VARIABLE_4)
+#endif
+#ifdef WATCH_VARIABLE_5_NAME
+                                     + sizeof(WATCH_VARIABLE_5)
+#endif
+#ifdef WATCH_VARIABLE_6_NAME
+                                     + sizeof(WATCH_VARIABLE_6)
+#endif
+#ifdef WATCH_VARIABLE_7_NAME
+                                     + sizeof(WATCH_VARIABLE_7)
+#endif
+#ifdef WATCH_VARIABLE_8_NAME
+                                     + sizeof(WATCH_VARIABLE_8)
+#endif
+#ifdef WATCH_VARIABLE_9_NAME
+                                     + sizeof(WATCH_VARIABLE_9)
+#endif
+#ifdef WATCH_VARIABLE_10_NAME
+                                     + sizeof(WATCH_VARIABLE_10)
+#endif
+#ifdef WATCH_VARIABLE_11_NAME
+                                     + sizeof(WATCH_VARIABLE_11)
+#endif
+#ifdef WATCH_VARIABLE_12_NAME
+                                     + sizeof(WATCH_VARIABLE_12)
+#endif
+#ifdef WATCH_VARIABLE_13_NAME
+                                     + sizeof(WATCH_VARIABLE_13)
+#endif
+#ifdef WATCH_VARIABLE_14_NAME
+                                     + sizeof(WATCH_VARIABLE_14)
+#endif
+#ifdef WATCH_VARIABLE_15_NAME
+                                     + sizeof(WATCH_VARIABLE_15)
+#endif
+#ifdef WATCH_VARIABLE_16_NAME
+                                     + sizeof(WATCH_VARIABLE_16)
+#endif
+#ifdef WATCH_VARIABLE_17_NAME
+                                     + sizeof(WATCH_VARIABLE_17)
+#endif
+#ifdef WATCH_VARIABLE_18_NAME
+                                     + sizeof(WATCH_VARIABLE_18)
+#endif
+#ifdef WATCH_VARIABLE_19_NAME
+                                     + sizeof(WATCH_VARIABLE_19)
+#endif
+#ifdef WATCH_VARIABLE_20_NAME
+                                     + sizeof(WATCH_VARIABLE_20)
+#endif
+                                     ;
 
-void WSVR_BreakPointInit(String strDebug_OnOff, String strHaltContinous)
+//bytes of each watch variable in a sample, in order, 0 ends the list
+const uint8_t WSVR_ucFieldSizes[] =
 {
-  // break point initialze variabel names
-  // "BPN#;NN;variable name1;...variable name 5;  # is 1 to 5, string these togather to populate all 25 variable names.
-  //BNP numbers don't need to be in order but the names between the BNPs will fill the teh column right below this BNP number
-  //initialize chart names and data scope size
-  //BPCN;NN;LL1;variable 1 lower limit,UU1; variable 1 upper limit;LL2;variable 2 lower limit,UU2; variable 2 upper limit;+
-  //LL3;variable 3 lower limit,UU3; variable 3 upper limit;LL4;variable 4 lower limit,UU4; variable 4 upper limit;LL5;variable 5 lower limit,UU5; variable 5 upper limit;+
-  //variable name1;...variable name 6;
+#ifdef WATCH_VARIABLE_1_NAME
+  sizeof(WATCH_VARIABLE_1),
+#endif
+#ifdef WATCH_VARIABLE_2_NAME
+  sizeof(WATCH_VARIABLE_2),
+#endif
+#ifdef WATCH_VARIABLE_3_NAME
+  sizeof(WATCH_VARIABLE_3),
+#endif
+#ifdef WATCH_VARIABLE_4_NAME
+  sizeof(WATCH_VARIABLE_4),
+#endif
+#ifdef WATCH_VARIABLE_5_NAME
+  sizeof(WATCH_VARIABLE_5),
+#endif
+#ifdef WATCH_VARIABLE_6_NAME
+  sizeof(WATCH_VARIABLE_6),
+#endif
+#ifdef WATCH_VARIABLE_7_NAME
+  sizeof(WATCH_VARIABLE_7),
+#endif
+#ifdef WATCH_VARIABLE_8_NAME
+  sizeof(WATCH_VARIABLE_8),
+#endif
+#ifdef WATCH_VARIABLE_9_NAME
+  sizeof(WATCH_VARIABLE_9),
+#endif
+#ifdef WATCH_VARIABLE_10_NAME
+  sizeof(WATCH_VARIABLE_10),
+#endif
+#ifdef WATCH_VARIABLE_11_NAME
+  sizeof(WATCH_VARIABLE_11),
+#endif
+#ifdef WATCH_VARIABLE_12_NAME
+  sizeof(WATCH_VARIABLE_12),
+#endif
+#ifdef WATCH_VARIABLE_13_NAME
+  sizeof(WATCH_VARIABLE_13),
+#endif
+#ifdef WATCH_VARIABLE_14_NAME
+  sizeof(WATCH_VARIABLE_14),
+#endif
+#ifdef WATCH_VARIABLE_15_NAME
+  sizeof(WATCH_VARIABLE_15),
+#endif
+#ifdef WATCH_VARIABLE_16_NAME
+  sizeof(WATCH_VARIABLE_16),
+#endif
+#ifdef WATCH_VARIABLE_17_NAME
+  sizeof(WATCH_VARIABLE_17),
+#endif
+#ifdef WATCH_VARIABLE_18_NAME
+  sizeof(WATCH_VARIABLE_18),
+#endif
+#ifdef WATCH_VARIABLE_19_NAME
+  sizeof(WATCH_VARIABLE_19),
+#endif
+#ifdef WATCH_VARIABLE_20_NAME
+  sizeof(WATCH_VARIABLE_20),
+#endif
+  0
+};
+const size_t WSVR_uiNumFields = sizeof(WSVR_ucFieldSizes) - 1;
+
+//worst case delta sample: a 3 byte mask (20 variables), and each variable one byte more than its size (a 33 bit zigzag
+//varint is 5 bytes)
+const size_t WSVR_uiMaxDelta = 3 + WSVR_uiSampleSize + WSVR_uiNumFields;
+
+static_assert(WSVR_FRAME_HEADER + WSVR_uiSampleSize <= WSVR_MAX_FRAME, "too many watch variables for a frame");
+static_assert((WSVR_SAMPLE_RING & (WSVR_SAMPLE_RING - 1)) == 0, "WSVR_SAMPLE_RING must be a power of 2");
+
+uint8_t WSVR_ucFrame[WSVR_MAX_FRAME];
+uint16_t WSVR_ui16Sequence = 0;
+
+//sample ring, only used on core 0 by the telemetry and break point tasks
+uint8_t WSVR_ucSamples[WSVR_SAMPLE_RING][WSVR_uiSampleSize];
+uint32_t WSVR_u32SampleTime[WSVR_SAMPLE_RING];
+uint32_t WSVR_u32SampleHead = 0;
+uint32_t WSVR_u32SampleTail = 0;
+uint32_t WSVR_u32SamplesDropped = 0;       //ring full, the break point task has fallen behind
+unsigned int WSVR_uiSamplePeriod = WSVR_SAMPLE_PERIOD;
+uint32_t WSVR_u32LastSample = 0;
+uint32_t WSVR_u32SampleCount = 0;          //samples packed since boot
+uint64_t WSVR_u64SampleCycles = 0;         //cycles spent packing them
+uint32_t WSVR_u32SamplesSent = 0;
+uint32_t WSVR_u32SampleBytes = 0;          //bytes of the sample frames, headers included
+uint32_t WSVR_u32Flushes = 0;              //flushes that had samples to send
+boolean WSVR_bHeapCheckSample = false;     //read the heap around the next sample packed
+uint32_t WSVR_u32HeapChecks = 0;           //live samples and frame builds the heap was read around
+int32_t WSVR_i32HeapBlocks = 0;            //heap blocks and bytes allocated across them, summed
+int32_t WSVR_i32HeapBytes = 0;
+
+//formatters for the text messages, each writes at pcOut and returns the end, stops at pcEnd and always leaves a '\0'
+static char *WSVR_FormatText(char *pcOut, const char *pcEnd, const char *pcText)
+{
+  while ((*pcText != '\0') && (pcOut < pcEnd - 1))
+  {
+    *pcOut++ = *pcText++;
+  }
+  *pcOut = '\0';
+  return (pcOut);
+}
 
+static char *WSVR_FormatUInt(char *pcOut, const char *pcEnd, uint32_t u32Value)
+{
+  char cDigits[10];
+  unsigned char ucCount = 0;
 
-  if (strDebug_OnOff.equals("DBON"))
+  do
   {
-    bWSVR_DebugOfOff = true;
+    cDigits[ucCount++] = '0' + (u32Value % 10);
+    u32Value /= 10;
+  } while (u32Value != 0);
+  while ((ucCount > 0) && (pcOut < pcEnd - 1))
+  {
+    *pcOut++ = cDigits[--ucCount];
   }
-  else
+  *pcOut = '\0';
+  return (pcOut);
+}
+
+static char *WSVR_FormatInt(char *pcOut, const char *pcEnd, int32_t i32Value)
+{
+  if ((i32Value < 0) && (pcOut < pcEnd - 1))
   {
-    bWSVR_DebugOfOff = false;
+    *pcOut++ = '-';
+    return (WSVR_FormatUInt(pcOut, pcEnd, 0 - (uint32_t)i32Value));
   }
+  return (WSVR_FormatUInt(pcOut, pcEnd, i32Value));
+}
+
+//fixed point value with ucFractionBits fraction bits, rounded to ucDecimals places (at most 4)
+static char *WSVR_FormatFixed(char *pcOut, const char *pcEnd, int32_t i32Value, unsigned char ucFractionBits, unsigned char ucDecimals)
+{
+  static const uint32_t u32Scales[] = {1, 10, 100, 1000, 10000};
+  uint32_t u32Scale = u32Scales[min(ucDecimals, (unsigned char)4)];
+  uint64_t u64Magnitude = (i32Value < 0) ? (0 - (uint64_t)(int64_t)i32Value) : (uint64_t)i32Value;
+  uint64_t u64Scaled = ((u64Magnitude * u32Scale) + ((1ULL << ucFractionBits) >> 1)) >> ucFractionBits;
+  uint32_t u32Fraction = u64Scaled % u32Scale;
 
-  if (strHaltContinous.equals("HALT"))
+  if ((i32Value < 0) && (u64Scaled != 0) && (pcOut < pcEnd - 1))
   {
-    bWSVR_HaltContinuous = false;
+    *pcOut++ = '-';
   }
-  else
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, u64Scaled / u32Scale);
+  if (u32Scale > 1)
   {
-    bWSVR_HaltContinuous = true;
+    pcOut = WSVR_FormatText(pcOut, pcEnd, ".");
+    for (uint32_t u32Digit = u32Scale / 10; u32Digit > 1 && u32Fraction < u32Digit; u32Digit /= 10)
+    {
+      pcOut = WSVR_FormatText(pcOut, pcEnd, "0");   //leading zeros of the fraction
+    }
+    pcOut = WSVR_FormatUInt(pcOut, pcEnd, u32Fraction);
   }
+  return (pcOut);
+}
 
-  strWSVR_VariableNames = String(String("N#^") + ";" + strDebug_OnOff) + ";" + String(strHaltContinous) + ";" + String("BPN") + ";" + String("CC") + ";"
+//type code for the schema, u/i/f and the size in bytes
+template <typename T> static char *WSVR_FormatTypeCode(char *pcOut, const char *pcEnd, T tValue)
+{
+  pcOut = WSVR_FormatText(pcOut, pcEnd, std::is_floating_point<T>::value ? "f" : (std::is_signed<T>::value ? "i" : "u"));
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, sizeof(T));
+  return (WSVR_FormatText(pcOut, pcEnd, ";"));
+}
 
+//copy one watch variable into the frame and step past it
+template <typename T> static void WSVR_PackField(uint8_t *&pucField, T tValue)
+{
+  memcpy(pucField, &tValue, sizeof(T));
+  pucField += sizeof(T);
+}
+
+//pack the watch variables in order, returns the end of the packed values
+static uint8_t *WSVR_PackValues(uint8_t *pucField)
+{
 #ifdef WATCH_VARIABLE_1_NAME
-                          + String("WV01") + ";" + String(WATCH_VARIABLE_1_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_1);
 #endif
 #ifdef WATCH_VARIABLE_2_NAME
-                          + String("WV02") + ";" + String(WATCH_VARIABLE_2_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_2);
 #endif
 #ifdef WATCH_VARIABLE_3_NAME
-                          + String("WV03") + ";" + String(WATCH_VARIABLE_3_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_3);
 #endif
 #ifdef WATCH_VARIABLE_4_NAME
-                          + String("WV04") + ";" + String(WATCH_VARIABLE_4_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_4);
 #endif
 #ifdef WATCH_VARIABLE_5_NAME
-                          + String("WV05") + ";" + String(WATCH_VARIABLE_5_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_5);
 #endif
 #ifdef WATCH_VARIABLE_6_NAME
-                          + String("WV06") + ";" + String(WATCH_VARIABLE_6_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_6);
 #endif
 #ifdef WATCH_VARIABLE_7_NAME
-                          + String("WV07") + ";" + String(WATCH_VARIABLE_7_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_7);
 #endif
 #ifdef WATCH_VARIABLE_8_NAME
-                          + String("WV08") + ";" + String(WATCH_VARIABLE_8_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_8);
 #endif
 #ifdef WATCH_VARIABLE_9_NAME
-                          + String("WV09") + ";" + String(WATCH_VARIABLE_9_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_9);
 #endif
 #ifdef WATCH_VARIABLE_10_NAME
-                          + String("WV10") + ";" + String(WATCH_VARIABLE_10_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_10);
 #endif
 #ifdef WATCH_VARIABLE_11_NAME
-                          + String("WV11") + ";" + String(WATCH_VARIABLE_11_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_11);
 #endif
 #ifdef WATCH_VARIABLE_12_NAME
-                          + String("WV12") + ";" + String(WATCH_VARIABLE_12_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_12);
 #endif
 #ifdef WATCH_VARIABLE_13_NAME
-                          + String("WV13") + ";" + String(WATCH_VARIABLE_13_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_13);
 #endif
 #ifdef WATCH_VARIABLE_14_NAME
-                          + String("WV14") + ";" + String(WATCH_VARIABLE_14_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_14);
 #endif
 #ifdef WATCH_VARIABLE_15_NAME
-                          + String("WV15") + ";" + String(WATCH_VARIABLE_15_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_15);
 #endif
 #ifdef WATCH_VARIABLE_16_NAME
-                          + String("WV16") + ";" + String(WATCH_VARIABLE_16_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_16);
 #endif
 #ifdef WATCH_VARIABLE_17_NAME
-                          + String("WV17") + ";" + String(WATCH_VARIABLE_17_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_17);
 #endif
 #ifdef WATCH_VARIABLE_18_NAME
-                          + String("WV18") + ";" + String(WATCH_VARIABLE_18_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_18);
 #endif
 #ifdef WATCH_VARIABLE_19_NAME
-                          + String("WV19") + ";" + String(WATCH_VARIABLE_19_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_19);
 #endif
 #ifdef WATCH_VARIABLE_20_NAME
-                          + String("WV20") + ";" + String(WATCH_VARIABLE_20_NAME) + ";"
+  WSVR_PackField(pucField, WATCH_VARIABLE_20);
 #endif
-                          + String("END");
+  return (pucField);
+}
+
+//end of a live heap check, add the change in the 8 bit heap since phiBefore to the sums WSVR_Benchmark reports
+static void WSVR_HeapCheckEnd(const multi_heap_info_t *phiBefore)
+{
+  multi_heap_info_t hiAfter;
 
+  heap_caps_get_info(&hiAfter, MALLOC_CAP_8BIT);
+  WSVR_i32HeapBlocks += (int32_t)(hiAfter.allocated_blocks - phiBefore->allocated_blocks);
+  WSVR_i32HeapBytes += (int32_t)(hiAfter.total_allocated_bytes - phiBefore->total_allocated_bytes);
+  WSVR_u32HeapChecks++;
 }
 
-void WSVR_BreakPoint(unsigned char ucBPindex)
+//core 0, add the watch variable values to the sample ring, call each time a control loop snapshot is received
+void WSVR_Sample(uint32_t u32Time)
 {
+  if (!bWSVR_DebugOfOff || !bWSVR_HaltContinuous)
+  {
+    return;
+  }
+  if ((u32Time - WSVR_u32LastSample) < WSVR_uiSamplePeriod)
+  {
+    return;
+  }
+  if ((WSVR_u32SampleHead - WSVR_u32SampleTail) >= WSVR_SAMPLE_RING)
+  {
+    WSVR_u32SamplesDropped++;
+    return;
+  }
 
-  if (bWSVR_DebugOfOff)
+  uint32_t u32Start;
+  uint32_t u32End;
+  boolean bHeapCheck = WSVR_bHeapCheckSample;
+  multi_heap_info_t hiBefore;
+
+  if (bHeapCheck)
+  {
+    heap_caps_get_info(&hiBefore, MALLOC_CAP_8BIT);
+  }
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Start)); // @ 240mHz clock each tick is ~4nS
+  WSVR_PackValues(WSVR_ucSamples[WSVR_u32SampleHead & (WSVR_SAMPLE_RING - 1)]);
+  asm volatile("esync; rsr %0,ccount":"=a" (u32End));
+  if (bHeapCheck)
+  {
+    WSVR_HeapCheckEnd(&hiBefore);
+    WSVR_bHeapCheckSample = false;
+  }
+
+  WSVR_u32SampleTime[WSVR_u32SampleHead & (WSVR_SAMPLE_RING - 1)] = u32Time;
+  WSVR_u32SampleHead++;
+  WSVR_u32LastSample = u32Time;
+  WSVR_u32SampleCount++;
+  WSVR_u64SampleCycles += u32End - u32Start;
+}
+
+//"R<mS>" from the web page, returns false if it's out of range
+boolean WSVR_SetSamplePeriod(unsigned int uiPeriod)
+{
+  if ((uiPeriod < 1) || (uiPeriod > 1000))
+  {
+    return (false);
+  }
+  WSVR_uiSamplePeriod = uiPeriod;
+  return (true);
+}
+
+//build the next sample frame in WSVR_ucFrame from the oldest samples in the ring (there must be one), returns its size
+static size_t WSVR_BuildSampleFrame()
+{
+  uint8_t *pucField = &WSVR_ucFrame[WSVR_FRAME_HEADER];
+  const uint8_t *pucPrevious = WSVR_ucSamples[WSVR_u32SampleTail & (WSVR_SAMPLE_RING - 1)];
+  uint32_t u32Count = 1;
+
+  WSVR_ucFrame[0] = WSVR_FRAME_SAMPLES;
+  memcpy(&WSVR_ucFrame[2], &WSVR_ui16Sequence, sizeof(WSVR_ui16Sequence));
+  memcpy(&WSVR_ucFrame[4], &WSVR_u32SampleTime[WSVR_u32SampleTail & (WSVR_SAMPLE_RING - 1)], sizeof(uint32_t));
+  WSVR_ui16Sequence++;
+
+  memcpy(pucField, pucPrevious, WSVR_uiSampleSize);
+  pucField += WSVR_uiSampleSize;
+  WSVR_u32SampleTail++;
+  while ((WSVR_u32SampleHead != WSVR_u32SampleTail) && (u32Count < 255) &&
+         (pucField + WSVR_uiMaxDelta <= &WSVR_ucFrame[WSVR_MAX_FRAME]))
+  {
+    const uint8_t *pucSample = WSVR_ucSamples[WSVR_u32SampleTail & (WSVR_SAMPLE_RING - 1)];
+
+    pucField = WSVR_PackDelta(pucField, pucSample, pucPrevious, WSVR_ucFieldSizes, WSVR_uiNumFields);
+    pucPrevious = pucSample;
+    WSVR_u32SampleTail++;
+    u32Count++;
+  }
+  WSVR_ucFrame[1] = u32Count;
+  return (pucField - WSVR_ucFrame);
+}
+
+//send the samples in the ring, as few frames as they fit in
+//every WSVR_HEAP_CHECK_FLUSHES flushes the heap is read around each frame build, and around the next sample packed
+static void WSVR_FlushSamples()
+{
+  boolean bHeapCheck;
+  multi_heap_info_t hiBefore;
+
+  if (WSVR_u32SampleHead == WSVR_u32SampleTail)
+  {
+    return;
+  }
+  WSVR_u32Flushes++;
+  bHeapCheck = ((WSVR_u32Flushes % WSVR_HEAP_CHECK_FLUSHES) == 0);
+  if (bHeapCheck)
+  {
+    WSVR_bHeapCheckSample = true;
+  }
+  while (WSVR_u32SampleHead != WSVR_u32SampleTail)
   {
+    if (bHeapCheck)
+    {
+      heap_caps_get_info(&hiBefore, MALLOC_CAP_8BIT);
+    }
+    size_t uiFrameSize = WSVR_BuildSampleFrame();
+    if (bHeapCheck)
+    {
+      WSVR_HeapCheckEnd(&hiBefore);     //the websocket send below is left out
+    }
 
-    strWSVR_VariableData = String("V#^") + ";" + String("CC") + ";"
+    WSVR_u32SamplesSent += WSVR_ucFrame[1];
+    WSVR_u32SampleBytes += uiFrameSize;
+    WSVR_SendBIN(WSVR_ucFrame, uiFrameSize);
+  }
+}
 
+//write the names message into WSVR_cVariableNames, returns false if it didn't fit
+static boolean WSVR_FormatNames(const char *strDebug_OnOff, const char *strHaltContinous)
+{
+  char *pcOut = WSVR_cVariableNames;
+  const char *pcEnd = &WSVR_cVariableNames[WSVR_NAMES_SIZE];
+
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "N#^;");
+  pcOut = WSVR_FormatText(pcOut, pcEnd, strDebug_OnOff);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, ";");
+  pcOut = WSVR_FormatText(pcOut, pcEnd, strHaltContinous);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, ";BPN;CC;");
 #ifdef WATCH_VARIABLE_1_NAME
-                           + String(WATCH_VARIABLE_1) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV01;" WATCH_VARIABLE_1_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_2_NAME
-                           + String(WATCH_VARIABLE_2) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV02;" WATCH_VARIABLE_2_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_3_NAME
-                           + String(WATCH_VARIABLE_3) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV03;" WATCH_VARIABLE_3_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_4_NAME
-                           + String(WATCH_VARIABLE_4) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV04;" WATCH_VARIABLE_4_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_5_NAME
-                           + String(WATCH_VARIABLE_5) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV05;" WATCH_VARIABLE_5_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_6_NAME
-                           + String(WATCH_VARIABLE_6) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV06;" WATCH_VARIABLE_6_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_7_NAME
-                           + String(WATCH_VARIABLE_7) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV07;" WATCH_VARIABLE_7_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_8_NAME
-                           + String(WATCH_VARIABLE_8) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV08;" WATCH_VARIABLE_8_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_9_NAME
-                           + String(WATCH_VARIABLE_9) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV09;" WATCH_VARIABLE_9_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_10_NAME
-                           + String(WATCH_VARIABLE_10) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV10;" WATCH_VARIABLE_10_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_11_NAME
-                           + String(WATCH_VARIABLE_11) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV11;" WATCH_VARIABLE_11_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_12_NAME
-                           + String(WATCH_VARIABLE_12) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV12;" WATCH_VARIABLE_12_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_13_NAME
-                           + String(WATCH_VARIABLE_13) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV13;" WATCH_VARIABLE_13_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_14_NAME
-                           + String(WATCH_VARIABLE_14) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV14;" WATCH_VARIABLE_14_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_15_NAME
-                           + String(WATCH_VARIABLE_15) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV15;" WATCH_VARIABLE_15_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_16_NAME
-                           + String(WATCH_VARIABLE_16) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV16;" WATCH_VARIABLE_16_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_17_NAME
-                           + String(WATCH_VARIABLE_17) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV17;" WATCH_VARIABLE_17_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_18_NAME
-                           + String(WATCH_VARIABLE_18) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV18;" WATCH_VARIABLE_18_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_19_NAME
-                           + String(WATCH_VARIABLE_19) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV19;" WATCH_VARIABLE_19_NAME ";");
 #endif
 #ifdef WATCH_VARIABLE_20_NAME
-                           + String(WATCH_VARIABLE_20) + ";"
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WV20;" WATCH_VARIABLE_20_NAME ";");
 #endif
-                           + String("END");
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "TYP;");
+#ifdef WATCH_VARIABLE_1_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_1);
+#endif
+#ifdef WATCH_VARIABLE_2_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_2);
+#endif
+#ifdef WATCH_VARIABLE_3_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_3);
+#endif
+#ifdef WATCH_VARIABLE_4_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_4);
+#endif
+#ifdef WATCH_VARIABLE_5_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_5);
+#endif
+#ifdef WATCH_VARIABLE_6_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_6);
+#endif
+#ifdef WATCH_VARIABLE_7_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_7);
+#endif
+#ifdef WATCH_VARIABLE_8_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_8);
+#endif
+#ifdef WATCH_VARIABLE_9_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_9);
+#endif
+#ifdef WATCH_VARIABLE_10_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_10);
+#endif
+#ifdef WATCH_VARIABLE_11_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_11);
+#endif
+#ifdef WATCH_VARIABLE_12_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_12);
+#endif
+#ifdef WATCH_VARIABLE_13_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_13);
+#endif
+#ifdef WATCH_VARIABLE_14_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_14);
+#endif
+#ifdef WATCH_VARIABLE_15_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_15);
+#endif
+#ifdef WATCH_VARIABLE_16_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_16);
+#endif
+#ifdef WATCH_VARIABLE_17_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_17);
+#endif
+#ifdef WATCH_VARIABLE_18_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_18);
+#endif
+#ifdef WATCH_VARIABLE_19_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_19);
+#endif
+#ifdef WATCH_VARIABLE_20_NAME
+  pcOut = WSVR_FormatTypeCode(pcOut, pcEnd, WATCH_VARIABLE_20);
+#endif
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "END");
+  return (pcOut < pcEnd - 1);
+}
+
+void WSVR_BreakPointInit(const char *strDebug_OnOff, const char *strHaltContinous)
+{
+  // break point initialze variabel names
+  // "BPN#;NN;variable name1;...variable name 5;  # is 1 to 5, string these togather to populate all 25 variable names.
+  //BNP numbers don't need to be in order but the names between the BNPs will fill the teh column right below this BNP number
+  //initialize chart names and data scope size
+  //BPCN;NN;LL1;variable 1 lower limit,UU1; variable 1 upper limit;LL2;variable 2 lower limit,UU2; variable 2 upper limit;+
+  //LL3;variable 3 lower limit,UU3; variable 3 upper limit;LL4;variable 4 lower limit,UU4; variable 4 upper limit;LL5;variable 5 lower limit,UU5; variable 5 upper limit;+
+  //variable name1;...variable name 6;
+
+
+  if (strcmp(strDebug_OnOff, "DBON") == 0)
+  {
+    bWSVR_DebugOfOff = true;
+  }
+  else
+  {
+    bWSVR_DebugOfOff = false;
+  }
+
+  if (strcmp(strHaltContinous, "HALT") == 0)
+  {
+    bWSVR_HaltContinuous = false;
+  }
+  else
+  {
+    bWSVR_HaltContinuous = true;
+  }
+
+  if (!WSVR_FormatNames(strDebug_OnOff, strHaltContinous))
+  {
+    Serial.println("Watch variable names don't fit in WSVR_NAMES_SIZE");
+  }
+
+}
+
+//cycles and heap allocations of the sample, frame and names code, 'b' over serial
+//the allocations are the change in the whole 8 bit heap from heap_caps_get_info, which works in the stock build, so a
+//task allocating on the other core meanwhile shows up too, run it a few times, the frames aren't sent
+void WSVR_Benchmark()
+{
+  const unsigned int uiRuns = 1000;
+  uint8_t ucSample[WSVR_uiSampleSize];
+  uint32_t u32Start;
+  uint32_t u32End;
+  uint32_t u32Samples = 0;
+  multi_heap_info_t hiBefore;
+  multi_heap_info_t hiAfter;
+  char cLine[160];
+  char *pcOut = cLine;
+  const char *pcEnd = &cLine[sizeof(cLine)];
+
+  WSVR_FlushSamples();                 //the ring is used below, send what is waiting first
+  uint16_t ui16Sequence = WSVR_ui16Sequence;
+
+  heap_caps_get_info(&hiBefore, MALLOC_CAP_8BIT);
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Start));
+  for (unsigned int uiRun = 0; uiRun < uiRuns; uiRun++)
+  {
+    WSVR_PackValues(ucSample);
+  }
+  asm volatile("esync; rsr %0,ccount":"=a" (u32End));
+  uint32_t u32PackCycles = u32End - u32Start;
+
+  for (unsigned int uiRun = 0; uiRun < WSVR_SAMPLE_RING; uiRun++)
+  {
+    WSVR_PackValues(WSVR_ucSamples[WSVR_u32SampleHead & (WSVR_SAMPLE_RING - 1)]);
+    WSVR_u32SampleTime[WSVR_u32SampleHead & (WSVR_SAMPLE_RING - 1)] = millis();
+    WSVR_u32SampleHead++;
+  }
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Start));
+  while (WSVR_u32SampleHead != WSVR_u32SampleTail)
+  {
+    WSVR_BuildSampleFrame();
+    u32Samples += WSVR_ucFrame[1];
+  }
+  asm volatile("esync; rsr %0,ccount":"=a" (u32End));
+  uint32_t u32FrameCycles = u32End - u32Start;
+  WSVR_ui16Sequence = ui16Sequence;    //not sent, so the web page shouldn't count them as lost
+
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Start));
+  WSVR_FormatNames(bWSVR_DebugOfOff ? "DBON" : "DBOF", bWSVR_HaltContinuous ? "CONT" : "HALT");
+  asm volatile("esync; rsr %0,ccount":"=a" (u32End));
+  heap_caps_get_info(&hiAfter, MALLOC_CAP_8BIT);
+
+  pcOut = WSVR_FormatText(pcOut, pcEnd, "WSVR sample ");
+  pcOut = WSVR_FormatFixed(pcOut, pcEnd, ((uint64_t)u32PackCycles << 8) / uiRuns, 8, 1);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " cycles, ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, WSVR_uiSampleSize);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " bytes, frames ");
+  pcOut = WSVR_FormatFixed(pcOut, pcEnd, ((uint64_t)u32FrameCycles << 8) / max(u32Samples, 1U), 8, 1);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " cycles per sample, names message ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, u32End - u32Start);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " cycles");
+  Serial.println(cLine);
+
+  pcOut = WSVR_FormatText(cLine, pcEnd, " heap allocated meanwhile ");
+  pcOut = WSVR_FormatInt(pcOut, pcEnd, (int32_t)(hiAfter.allocated_blocks - hiBefore.allocated_blocks));
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " blocks ");
+  pcOut = WSVR_FormatInt(pcOut, pcEnd, (int32_t)(hiAfter.total_allocated_bytes - hiBefore.total_allocated_bytes));
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " bytes");
+  Serial.println(cLine);
+
+  pcOut = WSVR_FormatText(cLine, pcEnd, " since boot ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, WSVR_u32SampleCount);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " samples, ");
+  pcOut = WSVR_FormatFixed(pcOut, pcEnd, WSVR_u32SampleCount ? (int32_t)((WSVR_u64SampleCycles << 8) / WSVR_u32SampleCount) : 0, 8, 1);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " cycles per sample, ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, WSVR_u32SamplesDropped);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " dropped, ");
+  pcOut = WSVR_FormatFixed(pcOut, pcEnd, WSVR_u32SamplesSent ? (int32_t)(((uint64_t)WSVR_u32SampleBytes << 8) / WSVR_u32SamplesSent) : 0, 8, 1);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " bytes sent per sample");
+  Serial.println(cLine);
+
+  pcOut = WSVR_FormatText(cLine, pcEnd, " live, ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, WSVR_u32HeapChecks);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " samples and frame builds checked over ");
+  pcOut = WSVR_FormatUInt(pcOut, pcEnd, WSVR_u32Flushes);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " flushes, heap allocated across them ");
+  pcOut = WSVR_FormatInt(pcOut, pcEnd, WSVR_i32HeapBlocks);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " blocks ");
+  pcOut = WSVR_FormatInt(pcOut, pcEnd, WSVR_i32HeapBytes);
+  pcOut = WSVR_FormatText(pcOut, pcEnd, " bytes");
+  Serial.println(cLine);
+}
+
+void WSVR_BreakPoint(unsigned char ucBPindex)
+{
+
+  if (bWSVR_DebugOfOff)
+  {
 
     if (bWSVR_HaltContinuous == false)
     {
@@ -351,11 +927,19 @@ void WSVR_BreakPoint(unsigned char ucBPindex)
 
       if ((ucBPindex != 0)  && (ucBPindex < 5))
       {
-        strWSVR_VariableData.setCharAt(4, 'H');
-        strWSVR_VariableData.setCharAt(5, (0x30 + ucBPindex));
+        uint32_t u32Time = millis();
+
+        WSVR_ucFrame[0] = WSVR_FRAME_DATA;
+        WSVR_ucFrame[1] = ucBPindex;
+        memcpy(&WSVR_ucFrame[2], &WSVR_ui16Sequence, sizeof(WSVR_ui16Sequence));
+        memcpy(&WSVR_ucFrame[4], &u32Time, sizeof(u32Time));
+        WSVR_ui16Sequence++;
+
+        size_t uiFrameSize = WSVR_PackValues(&WSVR_ucFrame[WSVR_FRAME_HEADER]) - WSVR_ucFrame;
+
         while (bWSVR_Halted)
         {
-          WSVR_SendMsg(strWSVR_VariableData);
+          WSVR_SendBIN(WSVR_ucFrame, uiFrameSize);
           webSocket.loop();
           WSVR_ButtonResponse();
           vTaskDelay(1);
@@ -366,14 +950,10 @@ void WSVR_BreakPoint(unsigned char ucBPindex)
         }
       }
 
-
-      strWSVR_VariableData.setCharAt(4, 'C');
-      strWSVR_VariableData.setCharAt(5, 'C');
-
     }
     else
     {
-      WSVR_SendMsg(strWSVR_VariableData);
+      WSVR_FlushSamples();
 
     }
 
@@ -388,6 +388,10 @@ table#DP01 th {
 
  var counttmr = 0;
  var vWorkingData;
+ var WatchTypes = [];
+ var FrameSequence = -1;
+ var FramesLost = 0;
+ var SampleView = null;   //latest sample of a batch, packed like the values of a type 1 frame
  ctx.moveTo(0,0);
  ctx.canvas.width = window.innerWidth* 0.85;
  ctx.canvas.height = window.innerHeight* 0.3;
@@ -396,6 +400,7 @@ table#DP01 th {
 
 
 var connection = new WebSocket('ws://' + location.hostname + ':81/', ['arduino']);
+connection.binaryType = "arraybuffer";
 connection.onopen = function () {
   connection.send('Connect ' + new Date());
   sendData(6);   //load graph/chart with names for debugging
@@ -410,22 +415,43 @@ connection.onclose = function () { console.log('WebSocket connection closed');};
 function onMessage(e) 
 {
 
+   if(e.data instanceof ArrayBuffer)  //watch variable values, binary frame
+   {
+    getData(new DataView(e.data));
+    return;
+   }
     // Print out our received message
     console.log("Received: " + e.data);
     vWorkingData = (e.data).split(";");
    if(vWorkingData[0] == "N#^")  //variable names so load charts/tables
    {
     getNames();
-   }
-   if(vWorkingData[0] == "V#^")  //Variable data , put in chart/table
-   {
-    WatchCommandIndex = 0;
-    WatchVariableIndex = 0;
-    getData();
+    getTypes();
    }
 }
-
   
+// Type code of each watch variable, listed after "TYP" in the names message
+function getTypes()
+{
+  var TypeIndex = vWorkingData.indexOf("TYP");
+
+  WatchTypes = [];
+  if(TypeIndex >= 0)
+  {
+    for (WatchIndexer=TypeIndex+1;(WatchIndexer<vWorkingData.length) && (vWorkingData[WatchIndexer] != "END");WatchIndexer++)
+    {
+      WatchTypes.push(vWorkingData[WatchIndexer]);
+    }
+  }
+  var SampleSize = 0;
+  for (WatchIndexer=0;WatchIndexer<WatchTypes.length;WatchIndexer++)
+  {
+    SampleSize = SampleSize + parseInt(WatchTypes[WatchIndexer].substring(1));
+  }
+  SampleView = new DataView(new ArrayBuffer(SampleSize));
+  FrameSequence = -1;
+}
+
 function getNames() 
 {
 
@@ -821,108 +847,208 @@ function Chartting()
 }
 
 
-function getData() 
+// Binary frames (see "BreakPoint.h"): type, break point or sample count, uint16 sequence, uint32 millis, then the values little endian
+// type 1 is one set of values while halted at a break point, type 2 is a batch of samples, each one is a step on the chart
+// a batch has the first sample packed in full, then each later one as a delta against the one before it
+function getData(vFrame) 
 {
 
-  
-  var ConvertFromString;
-  var Denominator = -50;
+  var Offset = 8;
+  var FrameType;
+  var BreakPointIndex;
+  var SampleCount;
+  var Sequence;
   
 
-   WatchCommandIndex = 0;
-   if(vWorkingData.length > 1)
+   if(vFrame.byteLength < Offset)
    {
-    
-     for (WatchIndexer=0;WatchIndexer<vWorkingData.length;WatchIndexer++)  
+     return;
+   }
+   FrameType = vFrame.getUint8(0);
+   Sequence = vFrame.getUint16(2, true);
+   if((FrameSequence >= 0) && (Sequence != FrameSequence) && (Sequence != ((FrameSequence + 1) & 0xFFFF)))
+   {
+     FramesLost = FramesLost + ((Sequence - FrameSequence - 1) & 0xFFFF);
+     console.log("Frames lost: " + FramesLost);
+   }
+   FrameSequence = Sequence;
+
+   if(FrameType == 1)
+   {
+     BreakPointIndex = vFrame.getUint8(1);
+     if((BreakPointIndex > 0) && (BreakPointIndex < 6))
+     {
+       WVH[BreakPointIndex - 1].style.backgroundColor = "red";
+       WatchColumHaltedAt = BreakPointIndex - 1;
+     }
+     getSample(vFrame, Offset, true);
+   }
+   if(FrameType == 2)
+   {
+     SampleCount = vFrame.getUint8(1);
+     if((SampleView == null) || ((Offset + SampleView.byteLength) > vFrame.byteLength))
      {
-       if(vWorkingData[WatchIndexer] == "H1")
+       return;
+     }
+     for (var ByteIndex=0;ByteIndex<SampleView.byteLength;ByteIndex++)
+     {
+       SampleView.setUint8(ByteIndex, vFrame.getUint8(Offset + ByteIndex));
+     }
+     Offset = Offset + SampleView.byteLength;
+     for (var SampleIndex=0;SampleIndex<SampleCount;SampleIndex++)
+     {
+       if(SampleIndex > 0)
        {
-         WatchCommandIndex = 2;
-         WatchVariableIndex = 0;
-         WVH[0].style.backgroundColor = "red";
-         WatchColumHaltedAt = 0;
+         Offset = getDelta(vFrame, Offset);
+         if(Offset < 0)
+         {
+           return;
+         }
        }
-       if(vWorkingData[WatchIndexer] == "H2")
+       getSample(SampleView, 0, SampleIndex == (SampleCount - 1));   //only the newest values go in the table
+       Chartting();
+     }
+   }
+}
+
+// Varint at Offset, 7 bits a byte least significant first, returns the value and the offset after it (-1 past the end)
+function getVarint(vFrame, Offset)
+{
+  var Value = 0;
+  var Scale = 1;
+  var Byte;
+
+   do
+   {
+     if(Offset >= vFrame.byteLength)
+     {
+       return {Value: 0, Offset: -1};
+     }
+     Byte = vFrame.getUint8(Offset);
+     Offset = Offset + 1;
+     Value = Value + ((Byte & 0x7F) * Scale);
+     Scale = Scale * 128;
+   } while(Byte & 0x80);
+   return {Value: Value, Offset: Offset};
+}
+
+// Apply one delta sample to SampleView: change mask, then for each changed variable a zigzag varint difference that wraps
+// at the variable's width (variables wider than 4 bytes come whole), returns the offset after it or -1
+function getDelta(vFrame, Offset)
+{
+  var Varint = getVarint(vFrame, Offset);
+  var Mask = Varint.Value;
+  var FieldOffset = 0;
+  var Size;
+  var Raw;
+  var Delta;
+  var Modulus;
+
+   Offset = Varint.Offset;
+   for (var FieldIndex=0;(FieldIndex<WatchTypes.length) && (Offset >= 0);FieldIndex++)
+   {
+     Size = parseInt(WatchTypes[FieldIndex].substring(1));
+     if(((Mask >> FieldIndex) & 1) && (Size > 4))
+     {
+       if((Offset + Size) > vFrame.byteLength)
        {
-         WatchCommandIndex = 2;
-         WatchVariableIndex = 0;
-         WVH[1].style.backgroundColor = "red";
-         WatchColumHaltedAt = 1;
+         return -1;
        }
-       if(vWorkingData[WatchIndexer] == "H3")
+       for (var ByteIndex=0;ByteIndex<Size;ByteIndex++)
        {
-         WatchCommandIndex = 2;
-         WatchVariableIndex = 0;
-         WVH[2].style.backgroundColor = "red";
-         WatchColumHaltedAt = 2;
+         SampleView.setUint8(FieldOffset + ByteIndex, vFrame.getUint8(Offset + ByteIndex));
        }
-       if(vWorkingData[WatchIndexer] == "H4")
+       Offset = Offset + Size;
+     }
+     else if((Mask >> FieldIndex) & 1)
+     {
+       Varint = getVarint(vFrame, Offset);
+       Offset = Varint.Offset;
+       Delta = (Varint.Value % 2 == 1) ? -(Varint.Value + 1) / 2 : Varint.Value / 2;
+       Modulus = Math.pow(2, Size * 8);
+       switch(Size)
        {
-         WatchCommandIndex = 2;
-         WatchVariableIndex = 0;
-         WVH[3].style.backgroundColor = "red";
-         WatchColumHaltedAt = 3;
+         case 1: Raw = SampleView.getUint8(FieldOffset); break;
+         case 2: Raw = SampleView.getUint16(FieldOffset, true); break;
+         case 4: Raw = SampleView.getUint32(FieldOffset, true); break;
+         default: return -1;
        }
-       if(vWorkingData[WatchIndexer] == "H5")
+       Raw = (((Raw + Delta) % Modulus) + Modulus) % Modulus;
+       switch(Size)
        {
-         WatchCommandIndex = 2;
-         WatchVariableIndex = 0;
-         WVH[4].style.backgroundColor = "red";
-         WatchColumHaltedAt = 4;
+         case 1: SampleView.setUint8(FieldOffset, Raw); break;
+         case 2: SampleView.setUint16(FieldOffset, Raw, true); break;
+         case 4: SampleView.setUint32(FieldOffset, Raw, true); break;
        }
-       if(vWorkingData[WatchIndexer] == "END")
+     }
+     FieldOffset = FieldOffset + Size;
+   }
+   return Offset;
+}
+
+// Decode one set of watch variables into the chart, and the table if ShowValues, returns the offset after it or -1
+function getSample(vFrame, Offset, ShowValues) 
+{
+
+  var Value;
+  var Denominator = -50;
+  
+
+   for (WatchVariableIndex=0;WatchVariableIndex<WatchTypes.length;WatchVariableIndex++)  
+   {
+     if((Offset + parseInt(WatchTypes[WatchVariableIndex].substring(1))) > vFrame.byteLength)
+     {
+       return -1;
+     }
+     switch(WatchTypes[WatchVariableIndex])
+     {
+       case "u1": Value = vFrame.getUint8(Offset); break;
+       case "i1": Value = vFrame.getInt8(Offset); break;
+       case "u2": Value = vFrame.getUint16(Offset, true); break;
+       case "i2": Value = vFrame.getInt16(Offset, true); break;
+       case "u4": Value = vFrame.getUint32(Offset, true); break;
+       case "i4": Value = vFrame.getInt32(Offset, true); break;
+       case "u8": Value = Number(vFrame.getBigUint64(Offset, true)); break;
+       case "i8": Value = Number(vFrame.getBigInt64(Offset, true)); break;
+       case "f4": Value = vFrame.getFloat32(Offset, true); break;
+       case "f8": Value = vFrame.getFloat64(Offset, true); break;
+       default: return -1;   //unknown type, the rest of the frame can't be located
+     }
+     Offset = Offset + parseInt(WatchTypes[WatchVariableIndex].substring(1));
+
+     if(ShowValues)
+     {
+       if(WatchTypes[WatchVariableIndex].charAt(0) == "f")
        {
-         WatchCommandIndex = 0;
+         WVD[WatchVariableIndex].innerHTML = Value.toFixed(2);
        }
-       
-       if(vWorkingData[WatchIndexer] == "CC")
+       else
        {
-         WatchCommandIndex = 2;
-         
+         WVD[WatchVariableIndex].innerHTML = Value;
        }
-       if(WatchCommandIndex == 3)
-       {
-         WVD[WatchVariableIndex].innerHTML = vWorkingData[WatchIndexer];
+     }
 
-         for (ChartVariableIndex=0;ChartVariableIndex<6;ChartVariableIndex++)  
-         {
-          if(WatchIndexer == 4)
-          {
-            WatchIndexer = 4;
-           
-          }
-           if(ChartWatchIndex[ChartVariableIndex] == WatchVariableIndex)
-           {
-            ConvertFromString = parseFloat(vWorkingData[WatchIndexer]);
-            Denominator = (ChartUpperLimits[ChartVariableIndex] - ChartLowerLimits[ChartVariableIndex]);
-            if(ChartLowerLimits[ChartVariableIndex] < 0)
-            {
-              
-              YAxis[ChartVariableIndex] = canHeight -  (((ChartLowerLimits[ChartVariableIndex] * -1) + ConvertFromString) * canHeight)/Denominator;
-            }
-            else
-            {
-              YAxis[ChartVariableIndex] = canHeight -  (ConvertFromString * canHeight)/Denominator;
-            }
-            
-           }
-         }
-         
-         WatchVariableIndex = WatchVariableIndex + 1;
-       }
-       if(WatchCommandIndex == 2)
+     for (ChartVariableIndex=0;ChartVariableIndex<6;ChartVariableIndex++)  
+     {
+       if(ChartWatchIndex[ChartVariableIndex] == WatchVariableIndex)
        {
-        WatchCommandIndex = 3;
+        Denominator = (ChartUpperLimits[ChartVariableIndex] - ChartLowerLimits[ChartVariableIndex]);
+        if(ChartLowerLimits[ChartVariableIndex] < 0)
+        {
+          
+          YAxis[ChartVariableIndex] = canHeight -  (((ChartLowerLimits[ChartVariableIndex] * -1) + Value) * canHeight)/Denominator;
+        }
+        else
+        {
+          YAxis[ChartVariableIndex] = canHeight -  (Value * canHeight)/Denominator;
+        }
+        
        }
-      
      }
    }
+   return Offset;
 }
 
-setInterval(function() {
-
-  Chartting();
-}, 100); //100mSeconds update rate
 
 
 
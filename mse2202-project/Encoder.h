@@ -11,6 +11,22 @@
 //---------------------------------------------------------------------------
 
 //#include "Motion.h";
+#include "Events.h"
+#include "NVS.h"
+
+#define ENC_CALIBRATION_LIMIT 0.25     //calibrated values more than this fraction off nominal are rejected
+#ifndef ENC_ISR_CORE
+#define ENC_ISR_CORE 1                  //core the GPIO interrupt (encoders, PB1 and the limit switch) is allocated on, control runs on core 1
+#endif
+//#define ENC_LATENCY_BENCHMARK 1       //measure encoder ISR latency by toggling left encoder A from the other core, wheels must be off the ground
+
+#ifdef ENC_LATENCY_BENCHMARK
+#include "Profiler.h"
+
+volatile boolean ENC_vbLatencyPending;
+volatile unsigned long ENC_vulLatencyIsrTime;
+volatile unsigned char ENC_vucLatencyIsrCore;
+#endif
 
 
 
@@ -55,15 +71,89 @@ volatile int32_t ENC_vi32RightOdometerCompare;
 volatile int32_t ENC_vsi32LastTimeLA;
 volatile int32_t ENC_vsi32ThisTimeLA;
 
-void ENC_Calibrate()
-{
-
-
-  //asm volatile("esync; rsr %0,ccount":"=a" (ENC_vsi32ThisTime)); // @ 240mHz clock each tick is ~4nS
+//odometry calibration, nominal (from the wheel size) until ENC_LoadCalibration finds a stored one
+double ENC_dNominalTicksPerCm;
+double ENC_dNominalWheelbase;
+double ENC_dLeftTicksPerCm;
+double ENC_dRightTicksPerCm;
+double ENC_dWheelbase;                  //cm, effective distance between the wheels' contact points
 
+static boolean ENC_NearNominal(double dValue, double dNominal)
+{
+  return ((dValue > dNominal * (1 - ENC_CALIBRATION_LIMIT)) && (dValue < dNominal * (1 + ENC_CALIBRATION_LIMIT)));
+}
 
+//call after NVS_Init, uses the stored calibration if there is one close enough to the nominal values
+void ENC_LoadCalibration(double dNominalTicksPerCm, double dNominalWheelbase)
+{
+  ENC_dNominalTicksPerCm = dNominalTicksPerCm;
+  ENC_dNominalWheelbase = dNominalWheelbase;
+  ENC_dLeftTicksPerCm = dNominalTicksPerCm;
+  ENC_dRightTicksPerCm = dNominalTicksPerCm;
+  ENC_dWheelbase = dNominalWheelbase;
+
+  if (NVS_Exists(NVS_ENC_LEFT_SCALE) && NVS_Exists(NVS_ENC_RIGHT_SCALE) && NVS_Exists(NVS_ENC_WHEELBASE) &&
+      ENC_NearNominal(NVS_ReadDouble(NVS_ENC_LEFT_SCALE), dNominalTicksPerCm) &&
+      ENC_NearNominal(NVS_ReadDouble(NVS_ENC_RIGHT_SCALE), dNominalTicksPerCm) &&
+      ENC_NearNominal(NVS_ReadDouble(NVS_ENC_WHEELBASE), dNominalWheelbase))
+  {
+    ENC_dLeftTicksPerCm = NVS_ReadDouble(NVS_ENC_LEFT_SCALE);
+    ENC_dRightTicksPerCm = NVS_ReadDouble(NVS_ENC_RIGHT_SCALE);
+    ENC_dWheelbase = NVS_ReadDouble(NVS_ENC_WHEELBASE);
+    Serial.printf("Loaded odometry calibration, ticks/cm left %.3f right %.3f, wheelbase %.2f cm\n", ENC_dLeftTicksPerCm,
+                  ENC_dRightTicksPerCm, ENC_dWheelbase);
+  }
+  else
+  {
+    Serial.printf("No odometry calibration, using nominal %.3f ticks/cm, wheelbase %.2f cm\n", dNominalTicksPerCm, dNominalWheelbase);
+  }
+}
 
+//work out each wheel's ticks per cm and the effective wheelbase from two runs, a simplified UMBmark
+//straight run: both wheels driven the same number of ticks, i32LeftTicks1/i32RightTicks1 counted,
+//  dDistance (cm) measured along the path and dHeading (degrees, clockwise positive) how far the robot turned
+//spin test: turned in place clockwise, i32LeftTicks2/i32RightTicks2 counted (magnitudes), dSpin (degrees) measured
+//a robot that veers clockwise moved its left wheel bHeading further than its right (b the wheelbase), and in the spin
+//both wheels together travel bSpin, which gives
+//  left / kL = d + b h / 2,  right / kR = d - b h / 2,  left2 / kL + right2 / kR = b s   (h, s in radians)
+//stores the result in NVS and returns true, or false if a value is too far off nominal to be a good measurement
+boolean ENC_Calibrate(int32_t i32LeftTicks1, int32_t i32RightTicks1, double dDistance, double dHeading,
+                      int32_t i32LeftTicks2, int32_t i32RightTicks2, double dSpin)
+{
+  double dH = dHeading * PI / 180;
+  double dS = dSpin * PI / 180;
+  double dLeftRatio;
+  double dRightRatio;
+  double dWheelbase;
+  double dLeftTicksPerCm;
+  double dRightTicksPerCm;
+
+  if ((i32LeftTicks1 <= 0) || (i32RightTicks1 <= 0) || (i32LeftTicks2 <= 0) || (i32RightTicks2 <= 0) || (dDistance <= 0) || (dSpin <= 0))
+  {
+    return (false);
+  }
+  dLeftRatio = (double)i32LeftTicks2 / i32LeftTicks1;
+  dRightRatio = (double)i32RightTicks2 / i32RightTicks1;
+  dWheelbase = dDistance * (dLeftRatio + dRightRatio) / (dS - dH / 2 * (dLeftRatio - dRightRatio));
+  dLeftTicksPerCm = i32LeftTicks1 / (dDistance + dWheelbase * dH / 2);
+  dRightTicksPerCm = i32RightTicks1 / (dDistance - dWheelbase * dH / 2);
+
+  Serial.printf("Odometry calibration, ticks/cm left %.3f right %.3f, wheelbase %.2f cm\n", dLeftTicksPerCm, dRightTicksPerCm, dWheelbase);
+  if (!ENC_NearNominal(dLeftTicksPerCm, ENC_dNominalTicksPerCm) || !ENC_NearNominal(dRightTicksPerCm, ENC_dNominalTicksPerCm) ||
+      !ENC_NearNominal(dWheelbase, ENC_dNominalWheelbase))
+  {
+    Serial.println("Odometry calibration rejected, too far from nominal");
+    return (false);
+  }
 
+  ENC_dLeftTicksPerCm = dLeftTicksPerCm;
+  ENC_dRightTicksPerCm = dRightTicksPerCm;
+  ENC_dWheelbase = dWheelbase;
+  NVS_StoreDouble(NVS_ENC_LEFT_SCALE, dLeftTicksPerCm);
+  NVS_StoreDouble(NVS_ENC_RIGHT_SCALE, dRightTicksPerCm);
+  NVS_StoreDouble(NVS_ENC_WHEELBASE, dWheelbase);
+  NVS_RequestCommit();
+  return (true);
 }
 
 boolean ENC_ISMotorRunning()
@@ -85,6 +175,14 @@ void IRAM_ATTR ENC_isrLeftA()
   volatile static int32_t ENC_vsi32LastTime;
   volatile static int32_t ENC_vsi32ThisTime;
 
+#ifdef ENC_LATENCY_BENCHMARK
+  if (ENC_vbLatencyPending)
+  {
+    ENC_vulLatencyIsrTime = micros();
+    ENC_vucLatencyIsrCore = xPortGetCoreID();
+    ENC_vbLatencyPending = false;
+  }
+#endif
 
   // if the last interrupts data wasn't collected, count the miss
   if (ENC_btLeftEncoderADataFlag)
@@ -126,6 +224,7 @@ void IRAM_ATTR ENC_isrLeftA()
       ledcWrite(1, 255); //stop with braking Left motor
       ledcWrite(3, 255);
       ledcWrite(4, 255); //stop with braking Right motor
+      EVT_PostFromISR(EVT_ENCODER_TARGET);
     }
 
   }
@@ -172,6 +271,7 @@ void IRAM_ATTR ENC_isrLeftB()
       ledcWrite(1, 255); //stop with braking Left motor
       ledcWrite(3, 255);
       ledcWrite(4, 255); //stop with braking Right motor
+      EVT_PostFromISR(EVT_ENCODER_TARGET);
     }
 
   }
@@ -217,6 +317,7 @@ void IRAM_ATTR ENC_isrRightA()
       ledcWrite(1, 255); //stop with braking Left motor
       ledcWrite(3, 255);
       ledcWrite(4, 255); //stop with braking Right motor
+      EVT_PostFromISR(EVT_ENCODER_TARGET);
     }
 
   }
@@ -263,16 +364,79 @@ void IRAM_ATTR ENC_isrRightB()
       ledcWrite(1, 255); //stop with braking Left motor
       ledcWrite(3, 255);
       ledcWrite(4, 255); //stop with braking Right motor
+      EVT_PostFromISR(EVT_ENCODER_TARGET);
     }
 
   }
 }
 //---------------------------------------------------------------------------------------------
 
+#ifdef ENC_LATENCY_BENCHMARK
+//toggles left encoder A every 2mS from the core the encoder interrupts aren't on and records how long the ISR took to see it
+//micros() is common to both cores, so the latency is to the nearest uS, results print with the profiler ('p' on serial)
+//compare ENC_ISR_CORE 0 and 1 with the web page open and streaming, ENC_ISR_CORE can be set from the build flags
+//(-DENC_ISR_CORE=0 -DENC_LATENCY_BENCHMARK) so both runs use the same source
+//each sample goes in the stage of the core the ISR actually ran on, so the report also shows the interrupt is where it should be
+void ENC_LatencyBenchmarkTask(void * pvParameters)
+{
+  unsigned char ucStage[2];
+  unsigned long ulTriggerTime;
+  boolean btLevel = false;
+
+  ucStage[0] = PRF_Register("ENC ISR latency, ISR on core 0");
+  ucStage[1] = PRF_Register("ENC ISR latency, ISR on core 1");
+  for (;;)
+  {
+    vTaskDelay(2);
+    btLevel = !btLevel;
+    ENC_vbLatencyPending = true;
+    ulTriggerTime = micros();
+    digitalWrite(ciEncoderLeftA, btLevel);
+    vTaskDelay(1);
+    if (!ENC_vbLatencyPending)
+    {
+      PRF_Record(ucStage[ENC_vucLatencyIsrCore], (ENC_vulLatencyIsrTime - ulTriggerTime) * PRF_CYCLES_PER_MICROSECOND);
+    }
+    ENC_vbLatencyPending = false;
+  }
+}
+#endif
+
+#ifdef ARDUINO_ISR_FLAG
+#define ENC_ISR_FLAGS ARDUINO_ISR_FLAG  //same flags attachInterrupt would install the service with
+#else
+#define ENC_ISR_FLAGS 0
+#endif
+
+static void ENC_InstallISRServiceTask(void * pvParameters)
+{
+  gpio_install_isr_service(ENC_ISR_FLAGS);
+  xTaskNotifyGive((TaskHandle_t)pvParameters);
+  vTaskDelete(NULL);
+}
+
+//every GPIO pin shares one interrupt, allocated on the core that installs the GPIO ISR service, and attachInterrupt installs
+//it on its first call from whatever core that is, so install it on ENC_ISR_CORE before any pin is attached
+//(attachInterrupt then finds it installed), call at the start of setup()
+void ENC_InstallISRService()
+{
+  if (xPortGetCoreID() == ENC_ISR_CORE)
+  {
+    gpio_install_isr_service(ENC_ISR_FLAGS);
+    return;
+  }
+  xTaskCreatePinnedToCore(ENC_InstallISRServiceTask, "ENC_ISRInstall", 2048, xTaskGetCurrentTaskHandle(), configMAX_PRIORITIES - 1, NULL, ENC_ISR_CORE);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
 void ENC_Init()
 {
   //set pin modes
+#ifdef ENC_LATENCY_BENCHMARK
+  pinMode(ciEncoderLeftA, INPUT_PULLUP | OUTPUT);   //pin mode has to be set before the interrupt is attached
+#else
   pinMode(ciEncoderLeftA, INPUT_PULLUP);
+#endif
   pinMode(ciEncoderLeftB, INPUT_PULLUP);
   pinMode(ciEncoderRightA, INPUT_PULLUP);
   pinMode(ciEncoderRightB, INPUT_PULLUP);
@@ -287,9 +451,11 @@ void ENC_Init()
   ENC_btRightMotorRunningFlag = false;
 
 
-  //check to see if calibration is in eeprom and retreive
-
+  //the odometry calibration is loaded from NVS by ENC_LoadCalibration, once the NVS is up
 
+#ifdef ENC_LATENCY_BENCHMARK
+  xTaskCreatePinnedToCore(ENC_LatencyBenchmarkTask, "ENC_Latency", 2048, NULL, 1, NULL, 1 - ENC_ISR_CORE);
+#endif
 }
 
 void ENC_Disable()
@@ -0,0 +1,62 @@
+/*
+  MSE 2202 Team 2
+
+  \Control task events
+
+  ISRs post events to the control task (the Arduino loop task on core 1) as FreeRTOS task notification bits
+  the control task blocks in EVT_Wait until an event is posted or its timeout runs out, so it only wakes when there is work
+*/
+
+#ifndef EVENTS_H
+#define EVENTS_H 1
+
+#define EVT_BUTTON 0x01             //PB1 pressed
+#define EVT_LIMIT_SWITCH 0x02       //climb limit switch closed (debounced)
+#define EVT_ENCODER_TARGET 0x04     //encoder odometer reached its compare target
+#define EVT_TIMER 0x08              //a timer in "TimerWheel.h" is due
+#define EVT_COMMAND 0x10            //a command from the web page was queued for the control task
+#define EVT_LIMIT_SWITCH_EDGE 0x20  //climb limit switch edge, (re)start its debounce timer
+
+TaskHandle_t EVT_htControlTask = NULL;
+
+//call from the control task before any ISR can post
+void EVT_Init()
+{
+  EVT_htControlTask = xTaskGetCurrentTaskHandle();
+}
+
+void IRAM_ATTR EVT_PostFromISR(uint32_t u32Events)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+  if (EVT_htControlTask == NULL)
+  {
+    return;
+  }
+  xTaskNotifyFromISR(EVT_htControlTask, u32Events, eSetBits, &xHigherPriorityTaskWoken);
+  if (xHigherPriorityTaskWoken)
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+
+//same as EVT_PostFromISR for tasks and esp_timer callbacks
+void EVT_Post(uint32_t u32Events)
+{
+  if (EVT_htControlTask == NULL)
+  {
+    return;
+  }
+  xTaskNotify(EVT_htControlTask, u32Events, eSetBits);
+}
+
+//returns the events posted since the last call, 0 if the timeout ran out first
+uint32_t EVT_Wait(TickType_t xTimeout)
+{
+  uint32_t u32Events = 0;
+
+  xTaskNotifyWait(0, 0xFFFFFFFF, &u32Events, xTimeout);
+  return (u32Events);
+}
+
+#endif
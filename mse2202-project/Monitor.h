@@ -0,0 +1,167 @@
+/*
+  MSE 2202 Team 2
+
+  \Task stack and heap monitor
+
+  runs once a second as a core 0 task (see "0_Core_Zero.h")
+  samples the stack high water mark (least free stack ever, in bytes) of every task FreeRTOS is running, and the free heap,
+  the least free heap ever, the largest free block and the fragmentation
+  prints a warning over serial when a value crosses its threshold, once until it recovers
+  websocket command 'M' sends MON_Report() to the web page
+
+  the report also carries the NVS commit statistics (commits, failures, last and worst request to flash latency, last flash time)
+
+  the task list comes from uxTaskGetSystemState (needs configUSE_TRACE_FACILITY, which arduino-esp32 turns on), so tasks
+  started by libraries or added later are watched without being listed here; a task keeps its slot (and its warning state)
+  while its handle is alive, slots of deleted tasks are freed
+
+  the 8 bit heap is several disjoint regions (DRAM split around the ROM and BT reserved areas), so the largest free block
+  can never be more than the biggest region and largest / free is well under half even on a clean heap. the first sample
+  takes a baseline: the free bytes outside the largest block then are the other regions. fragmentation is how much of
+  the free memory left in the largest region isn't one block, 0 at boot
+    region free = free - (boot free - boot largest)
+    fragmentation = 1000 - largest * 1000 / region free
+  allocations from the other regions make region free look smaller than it is, so this can under report, never over report
+*/
+
+#ifndef MONITOR_H
+#define MONITOR_H 1
+
+#include "NVS.h"
+
+#define MON_STACK_WARNING 512            //bytes of stack never used below which a task is close to overflowing
+#define MON_HEAP_WARNING 16384           //free heap bytes
+#define MON_FRAGMENTATION_WARNING 500    //per mille of the free memory in the largest region outside the largest free block
+#define MON_MAX_TASKS 24                 //arduino-esp32 with WiFi and the web server runs about 15
+
+struct MON_Task
+{
+  char cName[configMAX_TASK_NAME_LEN];   //FreeRTOS task name
+  TaskHandle_t htTask;                   //NULL when the slot is free
+  uint32_t u32StackFree;                 //stack high water mark in bytes
+  boolean btWarned;
+  boolean btSeen;
+};
+
+MON_Task MON_Tasks[MON_MAX_TASKS];
+TaskStatus_t MON_tsStatus[MON_MAX_TASKS];
+boolean MON_btTasksWarned = false;
+
+uint32_t MON_u32BootOtherFree = 0xFFFFFFFF;  //free bytes outside the largest block at the first sample, the other regions
+uint32_t MON_u32HeapFree;
+uint32_t MON_u32HeapMinimum;             //least free heap since boot
+uint32_t MON_u32HeapLargest;             //largest block that could be allocated
+unsigned int MON_uiFragmentation;        //per mille
+boolean MON_btHeapWarned = false;
+boolean MON_btFragmentationWarned = false;
+
+//print a warning when btBad first becomes true, and when it recovers
+static void MON_Warn(boolean btBad, boolean &btWarned, const char *strWhat, uint32_t u32Value)
+{
+  if (btBad && !btWarned)
+  {
+    Serial.printf("MON warning %s %lu\n", strWhat, (unsigned long)u32Value);
+  }
+  else if (!btBad && btWarned)
+  {
+    Serial.printf("MON ok %s %lu\n", strWhat, (unsigned long)u32Value);
+  }
+  btWarned = btBad;
+}
+
+//slot of htTask, or a free slot for a task not seen before, NULL when the table is full
+static MON_Task *MON_FindTask(TaskHandle_t htTask)
+{
+  MON_Task *ptFree = NULL;
+
+  for (unsigned char ucI = 0; ucI < MON_MAX_TASKS; ucI++)
+  {
+    if (MON_Tasks[ucI].htTask == htTask)
+    {
+      return (&MON_Tasks[ucI]);
+    }
+    if (MON_Tasks[ucI].htTask == NULL && ptFree == NULL)
+    {
+      ptFree = &MON_Tasks[ucI];
+    }
+  }
+  if (ptFree != NULL)
+  {
+    ptFree->htTask = htTask;
+    ptFree->btWarned = false;
+  }
+  return (ptFree);
+}
+
+void MON_Sample()
+{
+  UBaseType_t uxNumTasks = uxTaskGetSystemState(MON_tsStatus, MON_MAX_TASKS, NULL);   //0 when there are more than MON_MAX_TASKS
+
+  MON_Warn(uxNumTasks == 0, MON_btTasksWarned, "tasks more than", MON_MAX_TASKS);
+  for (unsigned char ucI = 0; ucI < MON_MAX_TASKS; ucI++)
+  {
+    MON_Tasks[ucI].btSeen = false;
+  }
+  for (UBaseType_t uxI = 0; uxI < uxNumTasks; uxI++)
+  {
+    MON_Task *ptTask = MON_FindTask(MON_tsStatus[uxI].xHandle);
+
+    if (ptTask == NULL)
+    {
+      continue;
+    }
+    strlcpy(ptTask->cName, MON_tsStatus[uxI].pcTaskName, sizeof(ptTask->cName));
+    ptTask->u32StackFree = MON_tsStatus[uxI].usStackHighWaterMark;   //bytes on the ESP32
+    ptTask->btSeen = true;
+    MON_Warn(ptTask->u32StackFree < MON_STACK_WARNING, ptTask->btWarned, ptTask->cName, ptTask->u32StackFree);
+  }
+  for (unsigned char ucI = 0; ucI < MON_MAX_TASKS; ucI++)
+  {
+    if (!MON_Tasks[ucI].btSeen)
+    {
+      MON_Tasks[ucI].htTask = NULL;      //deleted, or the list was too long to read this time
+    }
+  }
+
+  multi_heap_info_t hiHeap;
+  uint32_t u32RegionFree;
+
+  heap_caps_get_info(&hiHeap, MALLOC_CAP_8BIT);
+  MON_u32HeapFree = hiHeap.total_free_bytes;
+  MON_u32HeapMinimum = hiHeap.minimum_free_bytes;
+  MON_u32HeapLargest = hiHeap.largest_free_block;
+  if (MON_u32BootOtherFree == 0xFFFFFFFF)
+  {
+    MON_u32BootOtherFree = MON_u32HeapFree - MON_u32HeapLargest;
+  }
+  u32RegionFree = MON_u32HeapFree > MON_u32BootOtherFree ? MON_u32HeapFree - MON_u32BootOtherFree : 0;
+  MON_uiFragmentation = u32RegionFree > MON_u32HeapLargest ? 1000 - (uint32_t)(((uint64_t)MON_u32HeapLargest * 1000) / u32RegionFree) : 0;
+
+  MON_Warn(MON_u32HeapFree < MON_HEAP_WARNING, MON_btHeapWarned, "free heap", MON_u32HeapFree);
+  MON_Warn(MON_uiFragmentation > MON_FRAGMENTATION_WARNING, MON_btFragmentationWarned, "heap fragmentation per mille", MON_uiFragmentation);
+}
+
+//"M#^;task;stack free;...;heap;free;minimum;largest;fragmentation;nvs;commits;failures;latency;max latency;flash time;END" for the web page
+String MON_Report()
+{
+  String strReport = "M#^;";
+  char cField[48];
+
+  for (unsigned char ucI = 0; ucI < MON_MAX_TASKS; ucI++)
+  {
+    if (MON_Tasks[ucI].htTask != NULL)
+    {
+      snprintf(cField, sizeof(cField), "%s;%lu;", MON_Tasks[ucI].cName, (unsigned long)MON_Tasks[ucI].u32StackFree);
+      strReport += cField;
+    }
+  }
+  snprintf(cField, sizeof(cField), "heap;%lu;%lu;%lu;%u;", (unsigned long)MON_u32HeapFree, (unsigned long)MON_u32HeapMinimum,
+           (unsigned long)MON_u32HeapLargest, MON_uiFragmentation);
+  strReport += cField;
+  snprintf(cField, sizeof(cField), "nvs;%lu;%lu;%lu;%lu;%lu;END", (unsigned long)NVS_u32Commits, (unsigned long)NVS_u32Failures,
+           (unsigned long)NVS_u32LastLatency, (unsigned long)NVS_u32MaxLatency, (unsigned long)NVS_u32LastFlashTime);
+  strReport += cField;
+  return (strReport);
+}
+
+#endif
@@ -15,6 +15,13 @@
 #include <WebSocketsServer.h>
 
 void WSVR_ButtonResponse(void);
+String PRF_Report();
+String PM_Report();
+String MON_Report();
+String TUN_Report();
+boolean TUN_RequestValue(const char *strName, double dValue);
+bool requestCalibration(const double *values, unsigned char count);
+boolean WSVR_SetSamplePeriod(unsigned int uiPeriod);
 
 
 // Replace with your network credentials
@@ -42,8 +49,9 @@ unsigned char ucWSVR_WEBSocketConnected = 0;
 
 String strWSVR_ButtonState = "0";
 
-String strWSVR_VariableNames;
-String strWSVR_VariableData;
+#define WSVR_NAMES_SIZE 1024
+
+char WSVR_cVariableNames[WSVR_NAMES_SIZE];   //names message, see "BreakPoint.h"
 
 void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght)
 { // When a WebSocket message is received
@@ -84,7 +92,74 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght
           case 'L':
             {
 
-              webSocket.sendTXT(u8WSVR_WEBSocketID, strWSVR_VariableNames);
+              webSocket.sendTXT(u8WSVR_WEBSocketID, WSVR_cVariableNames);
+              break;
+            }
+          case 'S':   //execution time profile
+            {
+
+              webSocket.sendTXT(u8WSVR_WEBSocketID, PRF_Report());
+              break;
+            }
+          case 'M':   //task stacks and heap
+            {
+
+              webSocket.sendTXT(u8WSVR_WEBSocketID, MON_Report());
+              break;
+            }
+          case 'T':   //tunables
+            {
+
+              webSocket.sendTXT(u8WSVR_WEBSocketID, TUN_Report());
+              break;
+            }
+          case 'U':   //set a tunable, "U<name>;<value>"
+            {
+              char cName[32];
+              char *pcValue;
+
+              snprintf(cName, sizeof(cName), "%.*s", (int)lenght - 1, (const char *)&payload[1]);
+              pcValue = strchr(cName, ';');
+              if (pcValue)
+              {
+                *pcValue++ = '\0';
+                if (!TUN_RequestValue(cName, atof(pcValue)))
+                {
+                  Serial.printf("Tunable %s can't be set to %s\n", cName, pcValue);
+                }
+              }
+              break;
+            }
+          case 'K':   //odometry calibration, "K" to start, "K<value>[;<value>]" measurements, see "calibrate.h"
+            {
+              char cValues[32];
+              double dValues[2];
+              unsigned char ucCount = 0;
+              char *pcValue = cValues;
+
+              snprintf(cValues, sizeof(cValues), "%.*s", (int)lenght - 1, (const char *)&payload[1]);
+              while ((ucCount < 2) && (*pcValue != '\0'))
+              {
+                dValues[ucCount++] = atof(pcValue);
+                pcValue = strchr(pcValue, ';');
+                if (pcValue == NULL)
+                {
+                  break;
+                }
+                pcValue++;
+              }
+              requestCalibration(dValues, ucCount);
+              break;
+            }
+          case 'R':   //watch variable sample period, "R<mS>"
+            {
+              char cPeriod[12];
+
+              snprintf(cPeriod, sizeof(cPeriod), "%.*s", (int)lenght - 1, (const char *)&payload[1]);
+              if (!WSVR_SetSamplePeriod(atoi(cPeriod)))
+              {
+                Serial.printf("Sample period can't be set to %s\n", cPeriod);
+              }
               break;
             }
 
@@ -137,6 +212,12 @@ void WSVR_setupWEbServer(void)
 
   });
 
+  //post mortem log from "PostMortem.h"
+  server.on("/postmortem", HTTP_GET, [](AsyncWebServerRequest * request)
+  {
+    request->send(200, "text/plain", PM_Report());
+  });
+
 
 
   webSocket.begin();                          // start the websocket server
@@ -163,6 +244,15 @@ void WSVR_SendMsg(String strText)
 
 }
 
+void WSVR_SendBIN(const uint8_t *pucData, size_t uiLength)
+{
+  if (ucWSVR_WEBSocketConnected)
+  {
+    webSocket.sendBIN(u8WSVR_WEBSocketID, pucData, uiLength);
+  }
+
+}
+
 void WSVR_ButtonResponse(void)
 {
   ucWSVR_ButtonState = strWSVR_ButtonState.toInt();
@@ -205,7 +295,6 @@ void WSVR_ButtonResponse(void)
         Serial.println("UnHalt");
         bWSVR_Halted = false;
         strWSVR_ButtonState = "";
-        strWSVR_VariableData.replace("HH", "GG");
 
         break;
       }
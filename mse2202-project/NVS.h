@@ -3,365 +3,579 @@
   2020 05 13 E J Porter
 
 
-  \Non volitile storeage (EEPROM)
+  \Non volitile storeage (log structured key value store in flash)
+
+  values are stored by key (0 to NVS_MAX_KEYS - 1) in an append only log
+  the log uses the first 4 kB sector of each of the partitions "eeprom0", "eeprom1" and "eeprom2" (the old EEPROM areas)
+  only one sector is active at a time, NVS_Commit appends a record for each changed value (one small flash write)
+  when the active sector is full the current values are compacted into the next sector, round robin so the sectors wear evenly
+
+  sector layout
+  header (16 bytes): magic, sequence number (the valid sector with the highest is active), erase count, CRC32 of the header
+  records from offset 16, 4 byte aligned: CRC32, key, length, flags, marker, then the data
+  a record only counts once the record carrying NVS_FLAG_COMMIT after it (or itself) is read back with a good CRC,
+  so a commit that is cut off by a reset is ignored as a whole and the values from the commit before it are kept
+  compaction writes the records first and the sector header last, a sector without a good header is never used
+  tools/nvsSim.sh checks this on the host with power cuts at random points in writes and erases (20000 boots by default)
+
+  NVS_Init scans the active sector once at boot into a RAM copy of every value, reads are O(1) from RAM
+
+  commits are written by one low priority task on core 0, the only code that touches the flash after NVS_Init
+  NVS_RequestCommit only queues a commit and returns a ticket, NVS_CommitDone(ticket) says when it has been written
+  an append is one small flash write, a compaction erases a sector (tens of mS with both cores' flash cache off)
+  so compactions wait until the control task allows it with NVS_AllowErase (motors stopped)
+  commit latency (request to written) and flash time are kept for the web page, see MON_Report in "Monitor.h"
 */
 #ifndef NVS_H
 #define NVS_H 1
 
-#include <EEPROM.h>
+#include <esp_partition.h>
+#include <rom/crc.h>
 
-//DEBUG print
-#define DEBUGEEPROM 1
-#define DEBUGEEPROM2 1
-#define DEBUGEEPROM_COMMIT 1
+//DEBUG print, not in the host power loss test (it compacts thousands of times)
+#ifndef NVS_FLASH_SIM
+#define DEBUGNVS 1
+#endif
 
-#define NVS_HEADER 0xAA
-#define NVS_FOOTER 0x26
+//NVS_FLASH_SIM adds the emulated flash and power loss test in "NVSFlashSim.h", only tools/nvsSim.sh defines it
+
+#define NVS_NUM_SECTORS 3
+#define NVS_SECTOR_SIZE 4096
+#define NVS_MAX_KEYS 64
+#define NVS_MAX_LENGTH 8            //largest value (double)
+
+#define NVS_MAGIC 0x4C53564E        //"NVSL"
+#define NVS_RECORD_MARKER 0x5A      //erased flash reads 0xFF, so a record header that was never written can't look valid
+#define NVS_FLAG_COMMIT 0x01        //last record of a commit
+#define NVS_TASK_PRIORITY 0         //below the core 0 task table, commits run in its idle time
+#define NVS_TASK_STACK 4096
+
+//NVS_Init errors
+#define NVS_ERROR_PARTITION 0x01    //an "eeprom" partition is missing or too small
+#define NVS_ERROR_EMPTY 0x02        //no valid log sector, most likely new micro no data saved yet
+#define NVS_ERROR_TORN 0x04         //a damaged or incomplete commit was found and ignored, the values before it are loaded
+
+//Data keys
+#define NVS_CLIMB_BASELINE 0    //long, climb motor free running current baseline
+#define NVS_CLIMB_NOISE 1       //long, climb motor free running current standard deviation
+#define NVS_CLIMB_ROPE_SCALE 2  //long, climb rope estimator scale x 1000
+#define NVS_TUNABLES_SCHEMA 3   //unsigned long, signature of the tunables list in "Tunables.h"
+#define NVS_ENC_LEFT_SCALE 4    //double, left wheel encoder ticks per cm, see ENC_Calibrate in "Encoder.h"
+#define NVS_ENC_RIGHT_SCALE 5   //double, right wheel encoder ticks per cm
+#define NVS_ENC_WHEELBASE 6     //double, effective wheelbase in cm
+#define NVS_TUNABLES_FIRST 16   //long or double, one key per tunable in "Tunables.h" list order from here on
+
+struct NVS_SectorHeader
+{
+  uint32_t u32Magic;
+  uint32_t u32Sequence;
+  uint32_t u32EraseCount;
+  uint32_t u32Crc;
+};
 
-#define NVS_EEPROM_SIZE 32
-#define NVS_Header 0
-#define NVS_CRC_1 1
-#define NVS_CRC_2 2
-#define NVS_Footer 3
+struct NVS_RecordHeader
+{
+  uint32_t u32Crc;                  //CRC32 of the rest of the header and the data
+  uint8_t ucKey;
+  uint8_t ucLength;
+  uint8_t ucFlags;
+  uint8_t ucMarker;
+};
 
+#define NVS_RECORD_SIZE(length) (sizeof(NVS_RecordHeader) + (((length) + 3) & ~3))
 
+//flash access, replaceable so the store can run on something other than the ESP32's flash
+struct NVS_Flash
+{
+  boolean (*btRead)(unsigned char ucSector, uint32_t u32Offset, void *pvData, uint32_t u32Length);
+  boolean (*btWrite)(unsigned char ucSector, uint32_t u32Offset, const void *pvData, uint32_t u32Length);
+  boolean (*btErase)(unsigned char ucSector);
+};
 
-unsigned char NVS_Reverse(unsigned char crc);
+const esp_partition_t *NVS_ptPartitions[NVS_NUM_SECTORS];
 
-EEPROMClass  NVS_CRCArea("eeprom0", 4);
-EEPROMClass  NVS_Area1("eeprom1", NVS_EEPROM_SIZE);
-EEPROMClass  NVS_Area2("eeprom2", NVS_EEPROM_SIZE);
+static boolean NVS_PartitionRead(unsigned char ucSector, uint32_t u32Offset, void *pvData, uint32_t u32Length)
+{
+  return (esp_partition_read(NVS_ptPartitions[ucSector], u32Offset, pvData, u32Length) == ESP_OK);
+}
 
-boolean NVS_btEEpromArea1_2 = 0; //0 = area 1 ; 1 = area 2
+static boolean NVS_PartitionWrite(unsigned char ucSector, uint32_t u32Offset, const void *pvData, uint32_t u32Length)
+{
+  return (esp_partition_write(NVS_ptPartitions[ucSector], u32Offset, pvData, u32Length) == ESP_OK);
+}
+
+static boolean NVS_PartitionErase(unsigned char ucSector)
+{
+  return (esp_partition_erase_range(NVS_ptPartitions[ucSector], 0, NVS_SECTOR_SIZE) == ESP_OK);
+}
 
+NVS_Flash NVS_tFlash = {NVS_PartitionRead, NVS_PartitionWrite, NVS_PartitionErase};
 
-unsigned char NVS_ucTempRead;
-unsigned int NVS_uiCRC_1;
-unsigned int NVS_uiCRC_2;
-unsigned int NVS_uiCRC_Temp;
-unsigned int NVS_uiCRC_Temp2;
-unsigned int NVS_uiHeader;
-unsigned int NVS_uiFooter;
-unsigned int NVS_uiForCounter;
+//RAM copy of every committed value (plus uncommitted stores)
+uint8_t NVS_ucValues[NVS_MAX_KEYS][NVS_MAX_LENGTH];
+uint8_t NVS_ucLengths[NVS_MAX_KEYS];          //0 if the key has never been stored
+boolean NVS_btDirty[NVS_MAX_KEYS];            //stored since the last commit
+
+int NVS_iActiveSector = -1;                   //-1 until the first commit on a blank log
+uint32_t NVS_u32Sequence = 0;
+uint32_t NVS_u32AppendOffset = NVS_SECTOR_SIZE;
+uint32_t NVS_u32EraseCount[NVS_NUM_SECTORS];
+boolean NVS_btNeedsCompaction = false;        //the end of the active sector can't be trusted, compact before appending
 unsigned int NVS_ui_Error;
 
-unsigned char NVS_Init()
+//the RAM copy is written by the control task (stores) and read by the commit task (records), only held while copying
+portMUX_TYPE NVS_tMux = portMUX_INITIALIZER_UNLOCKED;
+
+TaskHandle_t NVS_htCommitTask = NULL;
+volatile uint32_t NVS_vu32Requested = 0;      //ticket of the last commit request
+volatile uint32_t NVS_vu32Completed = 0;      //ticket of the last request covered by a finished commit
+volatile boolean NVS_vbPending = false;       //requested since the commit task last started a commit
+volatile uint32_t NVS_vu32RequestTime;        //micros() of the first request not yet picked up
+volatile boolean NVS_vbLastOk = true;
+volatile boolean NVS_vbEraseAllowed = true;
+
+//commit statistics, written by the commit task only
+uint32_t NVS_u32Commits = 0;
+uint32_t NVS_u32Failures = 0;
+uint32_t NVS_u32LastLatency = 0;              //uS from the request to the commit being in the flash
+uint32_t NVS_u32MaxLatency = 0;
+uint32_t NVS_u32LastFlashTime = 0;            //uS spent writing (and erasing) the flash
+
+static uint32_t NVS_RecordCrc(const NVS_RecordHeader *ptHeader, const uint8_t *pucData)
 {
+  uint32_t u32Crc = crc32_le(0, &ptHeader->ucKey, sizeof(NVS_RecordHeader) - sizeof(ptHeader->u32Crc));
+  return (crc32_le(u32Crc, pucData, ptHeader->ucLength));
+}
 
-  NVS_btEEpromArea1_2 = 0;
-  NVS_ui_Error = 0;
-  //check to see if eeprom area exist
-  if (!NVS_CRCArea.begin(NVS_CRCArea.length()))
-  {
-    NVS_ui_Error = 0x01;
-  }
-  if (!NVS_Area1.begin(NVS_Area1.length()))
-  {
-    NVS_ui_Error |= 0x02;
-  }
-  if (!NVS_Area2.begin(NVS_Area2.length()))
-  {
-    NVS_ui_Error |= 0x04;
-  }
-  if (NVS_ui_Error == 0)
-  {
-    //check heater and footer ( footer is reversesand 2s ompoliment of header
-    //Header = 0xAA
-    //Footer = 0x26
-    NVS_uiHeader = NVS_CRCArea.readByte(NVS_Header);
-    NVS_uiFooter = NVS_CRCArea.readByte(NVS_Footer);
-    if ((NVS_uiHeader != NVS_HEADER) || (NVS_uiFooter != NVS_FOOTER))
-    {
-      NVS_ui_Error |= 0x08;
-    }
-    // check CRC for eeprom area 1 is = eeprom area 2
-    // checks CRC againts both Data sets
-    // if good then set RTC memory
-    // not set up then start fresh
-    //if corrupt then error message
-
-
-    // check CRC for eeprom area 1 is = eeprom area 2
-    NVS_uiCRC_1 = NVS_CRCArea.readByte(NVS_CRC_1);
-    NVS_uiCRC_2 = NVS_CRCArea.readByte(NVS_CRC_2);
-    //crc_2 in stored in revered bit and 2 complimented, need to undo
-    NVS_uiCRC_Temp = NVS_uiCRC_2;
-    NVS_uiCRC_Temp = ~NVS_uiCRC_Temp + 1;
-    NVS_uiCRC_Temp2 = NVS_Reverse(NVS_uiCRC_Temp);
-#ifdef DEBUGEEPROM2
-    Serial.println("");
-    Serial.print("CRC 1 = ");
-    Serial.println(NVS_uiCRC_1, HEX);
-    Serial.print("CRC 2 raw = ");
-    Serial.println(NVS_uiCRC_2, HEX);
-    Serial.print("CRC 2 2comp = ");
-    Serial.println(NVS_uiCRC_Temp, HEX);
-    Serial.print("CRC 2 reversed = ");
-    Serial.println(NVS_uiCRC_Temp2, HEX);
-
-#endif
-    NVS_uiCRC_2 = NVS_uiCRC_Temp2;
+static uint32_t NVS_HeaderCrc(const NVS_SectorHeader *ptHeader)
+{
+  return (crc32_le(0, (const uint8_t *)ptHeader, sizeof(NVS_SectorHeader) - sizeof(ptHeader->u32Crc)));
+}
 
-    NVS_uiCRC_Temp = 0;
-    for (NVS_uiForCounter = 0; NVS_uiForCounter < NVS_EEPROM_SIZE; NVS_uiForCounter++)
+//read every complete commit in the active sector into the RAM copy, sets the append offset after the last good record
+static void NVS_Scan()
+{
+  uint8_t ucPendingKeys[NVS_MAX_KEYS];
+  uint8_t ucPendingValues[NVS_MAX_KEYS][NVS_MAX_LENGTH];
+  uint8_t ucPendingLengths[NVS_MAX_KEYS];
+  unsigned int uiPending = 0;
+  uint32_t u32Offset = sizeof(NVS_SectorHeader);
+  uint32_t u32Committed = u32Offset;
+  NVS_RecordHeader tHeader;
+  uint8_t ucData[NVS_MAX_LENGTH];
+
+  while (u32Offset + sizeof(NVS_RecordHeader) <= NVS_SECTOR_SIZE)
+  {
+    if (!NVS_tFlash.btRead(NVS_iActiveSector, u32Offset, &tHeader, sizeof(tHeader)))
     {
-      NVS_uiCRC_Temp ^= NVS_Area1.readByte(NVS_uiForCounter);
+      break;
     }
-#ifdef DEBUGEEPROM2
-    Serial.println("");
-    Serial.print("CRC 1 chk ");
-    Serial.print("CRC 1 = ");
-    Serial.println(NVS_uiCRC_1, HEX);
-    Serial.print("CRC 1 calc = ");
-    Serial.println(NVS_uiCRC_Temp, HEX);
-
-#endif
-    if (NVS_uiCRC_Temp != NVS_uiCRC_1)
+    if ((tHeader.u32Crc == 0xFFFFFFFF) && (tHeader.ucKey == 0xFF) && (tHeader.ucLength == 0xFF) && (tHeader.ucFlags == 0xFF) && (tHeader.ucMarker == 0xFF))
     {
-      NVS_ui_Error |= 0x20;
+      break;   //erased, end of the log
     }
-    NVS_uiCRC_Temp2 = 0;
-    for (NVS_uiForCounter = 0; NVS_uiForCounter < NVS_EEPROM_SIZE; NVS_uiForCounter++)
+    if ((tHeader.ucMarker != NVS_RECORD_MARKER) || (tHeader.ucKey >= NVS_MAX_KEYS) || (tHeader.ucLength == 0) ||
+        (tHeader.ucLength > NVS_MAX_LENGTH) || (u32Offset + NVS_RECORD_SIZE(tHeader.ucLength) > NVS_SECTOR_SIZE) ||
+        (uiPending >= NVS_MAX_KEYS) ||
+        !NVS_tFlash.btRead(NVS_iActiveSector, u32Offset + sizeof(tHeader), ucData, tHeader.ucLength) ||
+        (NVS_RecordCrc(&tHeader, ucData) != tHeader.u32Crc))
     {
-      NVS_uiCRC_Temp2 ^= NVS_Area2.readByte(NVS_uiForCounter);
+      NVS_ui_Error |= NVS_ERROR_TORN;
+      break;
     }
-#ifdef DEBUGEEPROM2
-    Serial.println("");
-    Serial.print("CRC 2 chk ");
-    Serial.print("CRC 2 = ");
-    Serial.println(NVS_uiCRC_2, HEX);
-    Serial.print("CRC 2 calc = ");
-    Serial.println(NVS_uiCRC_Temp2, HEX);
 
-#endif
+    ucPendingKeys[uiPending] = tHeader.ucKey;
+    ucPendingLengths[uiPending] = tHeader.ucLength;
+    memcpy(ucPendingValues[uiPending], ucData, tHeader.ucLength);
+    uiPending++;
+    u32Offset += NVS_RECORD_SIZE(tHeader.ucLength);
 
-    if (NVS_uiCRC_Temp2 != NVS_uiCRC_2)
+    if (tHeader.ucFlags & NVS_FLAG_COMMIT)
     {
-      NVS_ui_Error |= 0x40;
+      for (unsigned int uiI = 0; uiI < uiPending; uiI++)
+      {
+        NVS_ucLengths[ucPendingKeys[uiI]] = ucPendingLengths[uiI];
+        memcpy(NVS_ucValues[ucPendingKeys[uiI]], ucPendingValues[uiI], ucPendingLengths[uiI]);
+      }
+      uiPending = 0;
+      u32Committed = u32Offset;
     }
+  }
 
-    if ((NVS_ui_Error & 0x02) && (NVS_uiCRC_Temp != NVS_uiCRC_Temp2))
-    {
-      NVS_ui_Error |= 0x200;
-    }
-    if ((NVS_ui_Error & 0x04) && (NVS_uiCRC_Temp2 != NVS_uiCRC_Temp))
-    {
-      NVS_ui_Error |= 0x400;
-    }
-    if (NVS_uiCRC_1 != NVS_uiCRC_2)
-    {
-      NVS_ui_Error |= 0x10;
-    }
-    if ((NVS_uiFooter == 0xFF) && (NVS_uiHeader == 0xFF) && (NVS_uiCRC_1 == 0xFF) && (NVS_uiCRC_2 == 0xFF))
-    {
-      NVS_ui_Error |= 0x80;
-    }
+  if ((uiPending != 0) || (NVS_ui_Error & NVS_ERROR_TORN))
+  {
+    //an incomplete commit (or damage) after u32Committed, the flash after it isn't erased so don't append to it
+    NVS_ui_Error |= NVS_ERROR_TORN;
+    NVS_btNeedsCompaction = true;
   }
-#ifdef DEBUGEEPROM
-  if (NVS_ui_Error)
+  NVS_u32AppendOffset = u32Committed;
+}
+
+//find the active sector and read it into the RAM copy, what a boot does before the commit task starts
+static unsigned char NVS_Load()
+{
+  static const char *strLabels[NVS_NUM_SECTORS] = {"eeprom0", "eeprom1", "eeprom2"};
+  NVS_SectorHeader tHeader;
+
+  NVS_ui_Error = 0;
+  NVS_iActiveSector = -1;
+  NVS_btNeedsCompaction = false;
+  memset(NVS_ucLengths, 0, sizeof(NVS_ucLengths));
+  memset(NVS_btDirty, 0, sizeof(NVS_btDirty));
+
+  for (unsigned char ucSector = 0; ucSector < NVS_NUM_SECTORS; ucSector++)
   {
-    Serial.println("");
-    Serial.print(" eeprom error = ");
-    Serial.println(NVS_ui_Error, BIN);
-    if (NVS_ui_Error & 0x07)
+    if (NVS_tFlash.btRead == NVS_PartitionRead)
     {
-      Serial.print("eeprom area not set: ");
-      if (NVS_ui_Error & 0x01)
+      NVS_ptPartitions[ucSector] = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, strLabels[ucSector]);
+      if ((NVS_ptPartitions[ucSector] == NULL) || (NVS_ptPartitions[ucSector]->size < NVS_SECTOR_SIZE))
       {
-        Serial.print(" CRC area, ");
+        NVS_ui_Error |= NVS_ERROR_PARTITION;
+        continue;
       }
-      if (NVS_ui_Error & 0x02)
-      {
-        Serial.print(" eeprom area 1, ");
-      }
-      if (NVS_ui_Error & 0x04)
-      {
-        Serial.print(" eeprom area 2, ");
-      }
-      Serial.println("");
-
-    }
-    if (NVS_ui_Error & 0x08)
-    {
-      Serial.println("");
-      Serial.print(" Header/Footer is corrupt ");
-      Serial.print(NVS_uiHeader, HEX);
-      Serial.print("/");
-      Serial.print(NVS_uiFooter, HEX);
-      Serial.print(" not 0xAA/0x26 ");
     }
-    if (NVS_ui_Error & 0xF0)
+
+    NVS_u32EraseCount[ucSector] = 0;
+    if (NVS_tFlash.btRead(ucSector, 0, &tHeader, sizeof(tHeader)) && (tHeader.u32Magic == NVS_MAGIC) && (NVS_HeaderCrc(&tHeader) == tHeader.u32Crc))
     {
-      if (NVS_ui_Error & 0x10)
+      NVS_u32EraseCount[ucSector] = tHeader.u32EraseCount;
+      if ((NVS_iActiveSector < 0) || (tHeader.u32Sequence > NVS_u32Sequence))
       {
-        Serial.print(" CRCs don't match");
-      }
-      if (NVS_ui_Error & 0x20)
-      {
-        Serial.print(" area 1 data corrupt, CRC_1 !=. ");
-      }
-      if (NVS_ui_Error & 0x200)
-      {
-        Serial.print(" area 1 data corrupt, CRC_2 !=. ");
-      }
-      if (NVS_ui_Error & 0x40)
-      {
-        Serial.print(" area 2 data corrupt, CRC_2 !=. ");
-      }
-      if (NVS_ui_Error & 0x400)
-      {
-        Serial.print(" area 2 data corrupt, CRC_1 !=. ");
-      }
-      Serial.println("");
-      if (NVS_ui_Error & 0x80)
-      {
-        Serial.println(" Most likely new micro not data saved yet");
+        NVS_iActiveSector = ucSector;
+        NVS_u32Sequence = tHeader.u32Sequence;
       }
     }
-    if ((NVS_ui_Error & 0x220) && (!(NVS_ui_Error & 0x040) && (!(NVS_ui_Error & 0x0400))))
-    {
-      NVS_btEEpromArea1_2 = 1; //use area 2
-    }
   }
-  else
+
+  if (NVS_ui_Error & NVS_ERROR_PARTITION)
   {
-    Serial.println("");
-    Serial.println(" eeprom error = ");
-    Serial.println(NVS_ui_Error);
+    NVS_iActiveSector = -1;
   }
-#endif
-  return (NVS_ui_Error);
-}
-
-uint8_t NVS_ReadUChar(unsigned int uiAddress) //one byte
-{
-  if (NVS_btEEpromArea1_2)
+  else if (NVS_iActiveSector < 0)
   {
-    return (NVS_Area2.readUChar(uiAddress));
+    NVS_ui_Error |= NVS_ERROR_EMPTY;
+    NVS_u32Sequence = 0;
   }
   else
   {
-    return (NVS_Area2.readUChar(uiAddress));
+    NVS_Scan();
   }
+  return (NVS_ui_Error);
 }
 
-uint16_t NVS_ReadUInt(unsigned  int uiAddress)//2 byte
+static void NVS_CommitTask(void *pvParameters);
+
+unsigned char NVS_Init()
 {
-  if (NVS_btEEpromArea1_2)
+  NVS_Load();
+
+  if (!(NVS_ui_Error & NVS_ERROR_PARTITION) && (NVS_htCommitTask == NULL))
   {
-    return (NVS_Area2.readUShort(uiAddress));
+    xTaskCreatePinnedToCore(NVS_CommitTask, "NVS_Commit", NVS_TASK_STACK, NULL, NVS_TASK_PRIORITY, &NVS_htCommitTask, 0);
   }
-  else
+
+#ifdef DEBUGNVS
+  Serial.println("");
+  Serial.printf(" nvs error = %u", NVS_ui_Error);
+  if (NVS_ui_Error & NVS_ERROR_PARTITION)
   {
-    return (NVS_Area1.readUShort(uiAddress));
+    Serial.print(", eeprom partitions missing");
   }
-}
-
-uint32_t NVS_ReadULong(unsigned  int uiAddress)//4 bytes
-{
-  if (NVS_btEEpromArea1_2)
+  if (NVS_ui_Error & NVS_ERROR_EMPTY)
   {
-    return (NVS_Area2.readULong(uiAddress));
+    Serial.print(", most likely new micro no data saved yet");
   }
-  else
+  if (NVS_ui_Error & NVS_ERROR_TORN)
   {
-    return (NVS_Area1.readULong(uiAddress));
+    Serial.print(", incomplete commit ignored");
   }
+  Serial.printf("\n nvs sector %d sequence %lu, %lu bytes used\n", NVS_iActiveSector, (unsigned long)NVS_u32Sequence,
+                (unsigned long)(NVS_iActiveSector < 0 ? 0 : NVS_u32AppendOffset));
+#endif
+  return (NVS_ui_Error);
 }
 
-int32_t NVS_ReadLong(unsigned  int uiAddress)//4 bytes
+//true if the key has a value (committed or stored)
+boolean NVS_Exists(unsigned int uiKey)
 {
-  if (NVS_btEEpromArea1_2)
-  {
-    return (NVS_Area2.readLong(uiAddress));
-  }
-  else
+  return ((uiKey < NVS_MAX_KEYS) && (NVS_ucLengths[uiKey] != 0));
+}
+
+static void NVS_Read(unsigned int uiKey, void *pvData, unsigned char ucLength)
+{
+  memset(pvData, 0, ucLength);
+  if (NVS_Exists(uiKey))
   {
-    return (NVS_Area1.readLong(uiAddress));
+    memcpy(pvData, NVS_ucValues[uiKey], min(ucLength, NVS_ucLengths[uiKey]));
   }
 }
 
-double_t NVS_ReadDouble(unsigned  int uiAddress)//8 bytes
+static void NVS_Store(unsigned int uiKey, const void *pvData, unsigned char ucLength)
 {
-  if (NVS_btEEpromArea1_2)
+  if (uiKey >= NVS_MAX_KEYS)
   {
-    return (NVS_Area2.readDouble(uiAddress));
+    return;
   }
-  else
+  portENTER_CRITICAL(&NVS_tMux);
+  if ((NVS_ucLengths[uiKey] != ucLength) || (memcmp(NVS_ucValues[uiKey], pvData, ucLength) != 0))   //unchanged, nothing to write
   {
-    return (NVS_Area1.readDouble(uiAddress));
+    memcpy(NVS_ucValues[uiKey], pvData, ucLength);
+    NVS_ucLengths[uiKey] = ucLength;
+    NVS_btDirty[uiKey] = true;
   }
+  portEXIT_CRITICAL(&NVS_tMux);
 }
 
-void NVS_StoreUChar(unsigned  int uiAddress, uint8_t ucData)
+uint8_t NVS_ReadUChar(unsigned int uiKey) //one byte
 {
-  Serial.println();
-  Serial.print(" d = ");
-  Serial.print(ucData);
-  Serial.print("  @ ");
-  Serial.println(uiAddress);
+  uint8_t ucData;
+  NVS_Read(uiKey, &ucData, sizeof(ucData));
+  return (ucData);
+}
 
-  NVS_Area1.writeUChar(uiAddress, ucData);
+uint16_t NVS_ReadUInt(unsigned  int uiKey)//2 byte
+{
+  uint16_t uiData;
+  NVS_Read(uiKey, &uiData, sizeof(uiData));
+  return (uiData);
 }
 
-void NVS_StoreUInt(unsigned  int uiAddress, uint16_t uiData)
+uint32_t NVS_ReadULong(unsigned  int uiKey)//4 bytes
 {
+  uint32_t ulData;
+  NVS_Read(uiKey, &ulData, sizeof(ulData));
+  return (ulData);
+}
 
-  NVS_Area1.writeUShort(uiAddress, uiData);
+int32_t NVS_ReadLong(unsigned  int uiKey)//4 bytes
+{
+  int32_t lData;
+  NVS_Read(uiKey, &lData, sizeof(lData));
+  return (lData);
 }
 
-void NVS_StoreULong(unsigned  int uiAddress, uint32_t ulData)
+double_t NVS_ReadDouble(unsigned  int uiKey)//8 bytes
 {
+  double_t dData;
+  NVS_Read(uiKey, &dData, sizeof(dData));
+  return (dData);
+}
 
-  NVS_Area1.writeULong(uiAddress, ulData);
+void NVS_StoreUChar(unsigned  int uiKey, uint8_t ucData)
+{
+  NVS_Store(uiKey, &ucData, sizeof(ucData));
 }
 
-void NVS_StoreLong(unsigned  int uiAddress, int32_t lData)
+void NVS_StoreUInt(unsigned  int uiKey, uint16_t uiData)
 {
+  NVS_Store(uiKey, &uiData, sizeof(uiData));
+}
+
+void NVS_StoreULong(unsigned  int uiKey, uint32_t ulData)
+{
+  NVS_Store(uiKey, &ulData, sizeof(ulData));
+}
+
+void NVS_StoreLong(unsigned  int uiKey, int32_t lData)
+{
+  NVS_Store(uiKey, &lData, sizeof(lData));
+}
+
+void NVS_StoreDouble(unsigned  int uiKey, double_t dData)
+{
+  NVS_Store(uiKey, &dData, sizeof(dData));
+}
 
-  NVS_Area1.writeLong(uiAddress, lData);
+//build the records for every key with btAll (compaction) or every dirty key into pucBuffer, returns the bytes used
+//the keys written are no longer dirty and are marked in btTaken, so a failed commit can mark them dirty again
+static uint32_t NVS_BuildRecords(uint8_t *pucBuffer, boolean btAll, boolean *btTaken)
+{
+  uint32_t u32Used = 0;
+  NVS_RecordHeader *ptLast = NULL;
+
+  portENTER_CRITICAL(&NVS_tMux);
+  for (unsigned int uiKey = 0; uiKey < NVS_MAX_KEYS; uiKey++)
+  {
+    if ((NVS_ucLengths[uiKey] == 0) || !(btAll || NVS_btDirty[uiKey]))
+    {
+      continue;
+    }
+    NVS_RecordHeader *ptHeader = (NVS_RecordHeader *)&pucBuffer[u32Used];
+    ptHeader->ucKey = uiKey;
+    ptHeader->ucLength = NVS_ucLengths[uiKey];
+    ptHeader->ucFlags = 0;
+    ptHeader->ucMarker = NVS_RECORD_MARKER;
+    memset(&pucBuffer[u32Used + sizeof(NVS_RecordHeader)], 0xFF, NVS_RECORD_SIZE(ptHeader->ucLength) - sizeof(NVS_RecordHeader));
+    memcpy(&pucBuffer[u32Used + sizeof(NVS_RecordHeader)], NVS_ucValues[uiKey], ptHeader->ucLength);
+    u32Used += NVS_RECORD_SIZE(ptHeader->ucLength);
+    ptLast = ptHeader;
+    btTaken[uiKey] |= NVS_btDirty[uiKey];
+    NVS_btDirty[uiKey] = false;
+  }
+  portEXIT_CRITICAL(&NVS_tMux);
+
+  //the commit flag goes on the last record, then every CRC can be worked out
+  if (ptLast)
+  {
+    ptLast->ucFlags = NVS_FLAG_COMMIT;
+  }
+  for (uint32_t u32Offset = 0; u32Offset < u32Used; )
+  {
+    NVS_RecordHeader *ptHeader = (NVS_RecordHeader *)&pucBuffer[u32Offset];
+    ptHeader->u32Crc = NVS_RecordCrc(ptHeader, &pucBuffer[u32Offset + sizeof(NVS_RecordHeader)]);
+    u32Offset += NVS_RECORD_SIZE(ptHeader->ucLength);
+  }
+  return (u32Used);
 }
 
-void NVS_StoreDouble(unsigned  int uiAddress, double_t dData)
+//write every value into the next sector, the old sector stays active until the new header is written
+static boolean NVS_Compact(boolean *btTaken)
 {
+  static uint8_t ucBuffer[NVS_MAX_KEYS * NVS_RECORD_SIZE(NVS_MAX_LENGTH)];
+  unsigned char ucSector = (NVS_iActiveSector + 1) % NVS_NUM_SECTORS;
+  NVS_SectorHeader tHeader;
+  uint32_t u32Used;
+
+  //the erase stalls both cores, wait until the motors are stopped, anything stored meanwhile goes in with the rest
+  while (!NVS_vbEraseAllowed)
+  {
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  u32Used = NVS_BuildRecords(ucBuffer, true, btTaken);
 
-  NVS_Area1.writeDouble(uiAddress, dData);
+  if (!NVS_tFlash.btErase(ucSector))
+  {
+    return (false);
+  }
+  NVS_u32EraseCount[ucSector]++;
+  if ((u32Used != 0) && !NVS_tFlash.btWrite(ucSector, sizeof(NVS_SectorHeader), ucBuffer, u32Used))
+  {
+    return (false);
+  }
+
+  tHeader.u32Magic = NVS_MAGIC;
+  tHeader.u32Sequence = NVS_u32Sequence + 1;
+  tHeader.u32EraseCount = NVS_u32EraseCount[ucSector];
+  tHeader.u32Crc = NVS_HeaderCrc(&tHeader);
+  if (!NVS_tFlash.btWrite(ucSector, 0, &tHeader, sizeof(tHeader)))
+  {
+    return (false);
+  }
 
+  NVS_iActiveSector = ucSector;
+  NVS_u32Sequence = tHeader.u32Sequence;
+  NVS_u32AppendOffset = sizeof(NVS_SectorHeader) + u32Used;
+  NVS_btNeedsCompaction = false;
+#ifdef DEBUGNVS
+  Serial.printf(" nvs compacted into sector %u (erased %lu times)\n", ucSector, (unsigned long)tHeader.u32EraseCount);
+#endif
+  return (true);
 }
 
+//append the values stored since the last commit, all of them survive a reset or none do
+//returns false if the flash couldn't be written, the values are kept in RAM and written by the next commit
+//commit task only
+static boolean NVS_WriteCommit()
+{
+  static uint8_t ucBuffer[NVS_MAX_KEYS * NVS_RECORD_SIZE(NVS_MAX_LENGTH)];
+  boolean btTaken[NVS_MAX_KEYS] = {false};
+  uint32_t u32Used;
+  boolean btOk;
 
+  u32Used = NVS_BuildRecords(ucBuffer, false, btTaken);
+  if (u32Used == 0)
+  {
+    return (true);
+  }
 
-//Commit Area 1 when the unit is when put to sleep/Shutdown
-//does a RAID commit
-void NVS_Commit()
+  if ((NVS_iActiveSector < 0) || NVS_btNeedsCompaction || (NVS_u32AppendOffset + u32Used > NVS_SECTOR_SIZE))
+  {
+    btOk = NVS_Compact(btTaken);
+  }
+  else
+  {
+    btOk = NVS_tFlash.btWrite(NVS_iActiveSector, NVS_u32AppendOffset, ucBuffer, u32Used);
+    NVS_u32AppendOffset += u32Used;   //even if the write failed part of it may be in the flash
+    if (!btOk)
+    {
+      NVS_btNeedsCompaction = true;
+    }
+  }
+
+  if (!btOk)
+  {
+    portENTER_CRITICAL(&NVS_tMux);
+    for (unsigned int uiKey = 0; uiKey < NVS_MAX_KEYS; uiKey++)
+    {
+      NVS_btDirty[uiKey] |= btTaken[uiKey];
+    }
+    portEXIT_CRITICAL(&NVS_tMux);
+  }
+  return (btOk);
+}
+
+static void NVS_CommitTask(void *pvParameters)
 {
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    NVS_vbPending = false;
+    uint32_t u32Ticket = NVS_vu32Requested;
+    uint32_t u32RequestTime = NVS_vu32RequestTime;
+    uint32_t u32Start = micros();
+    boolean btOk = NVS_WriteCommit();
+    uint32_t u32End = micros();
+
+    NVS_u32LastFlashTime = u32End - u32Start;
+    NVS_u32LastLatency = u32End - u32RequestTime;
+    NVS_u32MaxLatency = max(NVS_u32MaxLatency, NVS_u32LastLatency);
+    NVS_u32Commits++;
+    if (!btOk)
+    {
+      NVS_u32Failures++;
+    }
+    NVS_vbLastOk = btOk;
+    NVS_vu32Completed = u32Ticket;
+#ifdef DEBUGNVS
+    Serial.printf(" nvs commit %s, %lu uS after the request, %lu uS writing\n", btOk ? "ok" : "failed",
+                  (unsigned long)NVS_u32LastLatency, (unsigned long)NVS_u32LastFlashTime);
+#endif
+  }
+}
 
-  NVS_uiCRC_Temp = 0;
-  NVS_Area1.commit();
-  for (NVS_uiForCounter = 0; NVS_uiForCounter < NVS_EEPROM_SIZE; NVS_uiForCounter++)
+//queue a commit of everything stored so far and return straight away, returns a ticket for NVS_CommitDone
+//control task (core 1) only
+uint32_t NVS_RequestCommit()
+{
+  if ((NVS_ui_Error & NVS_ERROR_PARTITION) || (NVS_htCommitTask == NULL))
   {
-    NVS_ucTempRead = NVS_Area1.readByte(NVS_uiForCounter);
-    NVS_Area2.writeByte(NVS_uiForCounter, NVS_ucTempRead);
-    NVS_uiCRC_Temp ^= NVS_ucTempRead;
+    return (NVS_vu32Requested);
   }
-  NVS_Area2.commit();
-  NVS_CRCArea.writeByte(NVS_Header, NVS_HEADER);
-  NVS_CRCArea.writeByte(NVS_CRC_1, NVS_uiCRC_Temp);
-  NVS_uiCRC_Temp =  NVS_Reverse(NVS_uiCRC_Temp);
-  NVS_uiCRC_Temp = ~NVS_uiCRC_Temp + 1;
-  NVS_CRCArea.writeByte(NVS_CRC_2, NVS_uiCRC_Temp);
-  NVS_CRCArea.writeByte(NVS_Footer, NVS_FOOTER);
-  NVS_CRCArea.commit();
+  if (!NVS_vbPending)
+  {
+    NVS_vu32RequestTime = micros();
+    NVS_vbPending = true;
+  }
+  NVS_vu32Requested = NVS_vu32Requested + 1;
+  xTaskNotifyGive(NVS_htCommitTask);
+  return (NVS_vu32Requested);
+}
 
+//true once the commit for u32Ticket has been tried, NVS_vbLastOk says if it was written
+boolean NVS_CommitDone(uint32_t u32Ticket)
+{
+  return ((int32_t)(NVS_vu32Completed - u32Ticket) >= 0);
 }
 
-unsigned char NVS_Reverse(unsigned char crc)
+//control task, allow compactions (sector erases) only while a flash stall can't hurt, e.g. motors stopped
+void NVS_AllowErase(boolean btAllow)
 {
-  crc = (crc & 0xF0) >> 4 | (crc & 0x0F) << 4;
-  crc = (crc & 0xCC) >> 2 | (crc & 0x33) << 2;
-  crc = (crc & 0xAA) >> 1 | (crc & 0x55) << 1;
-  return crc;
+  NVS_vbEraseAllowed = btAllow;
 }
 
+#ifdef NVS_FLASH_SIM
+#include "NVSFlashSim.h"
+#endif
 
 #endif
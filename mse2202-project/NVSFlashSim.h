@@ -0,0 +1,303 @@
+/*
+  MSE 2202 Team 2
+
+  \Emulated flash for the NVS with power loss injection
+
+  a host test, not part of the firmware: tools/nvsSim.sh compiles "NVS.h" with NVS_FLASH_SIM defined against the shims in
+  tools/hostShims with g++ and runs NVS_SIM_Run, so storage changes can be checked on Linux without a board
+  the NVS runs on this RAM copy of its three sectors instead of the eeprom partitions
+
+  the emulation behaves like NOR flash: an erase sets a whole 4 kB sector to 0xFF, a write can only clear bits
+  (writing a 1 over a 0 is counted as an overwrite, which the NVS should never do)
+  erase and program times are modelled from typical ESP32 flash figures, and every sector's erases are counted for wear
+
+  power loss
+  NVS_SIM_i32Budget is the number of bytes that can still be written (an erase counts as one) before the power is cut
+  the byte being written when the power goes is left half programmed, an erase that is cut off leaves the sector part erased
+  after a cut every flash access fails until the next emulated boot
+
+  NVS_SIM_Run(boots) is the power loss test, each boot runs NVS_Load like a reset would and checks the values it comes up with
+  are exactly the last complete commit (or the one that was cut off, if enough of it got into the flash)
+  then stores and commits random values, cutting the power during one in NVS_SIM_APPEND_CUT appends and one in
+  NVS_SIM_COMPACTION_CUT compactions (they are only about one commit in 35, but they're where a cut can lose everything)
+  every commit is run once uncut to measure it, then the flash is put back, the RAM copy reloaded from it and the same
+  values stored and committed again, with the budget armed when it is to be cut
+  the cut point is picked uniformly over every byte that commit writes, so for a compaction it can land in the erase, the
+  records or the new sector header
+  prints the boots that came up inconsistent, where the cuts landed, erases per commit, sector wear, and the commit and
+  boot scan times (CPU time is the host's, flash time is modelled), returns the number of inconsistent boots
+  random() is seeded by the harness, so the counts are the same on every run with the same seed
+*/
+
+#ifndef NVSFLASHSIM_H
+#define NVSFLASHSIM_H 1
+
+#define NVS_SIM_ERASE_US 45000              //typical 4 kB sector erase
+#define NVS_SIM_PROGRAM_US_PER_BYTE 3       //about 0.7 mS per 256 byte page
+#define NVS_SIM_COMMITS 10                  //commits per emulated boot
+#define NVS_SIM_MAX_STORES 4                //values stored per commit
+#define NVS_SIM_APPEND_CUT 40               //one in this many appends has the power cut
+#define NVS_SIM_COMPACTION_CUT 2            //one in this many compactions has the power cut
+
+uint8_t NVS_SIM_ucFlash[NVS_NUM_SECTORS][NVS_SECTOR_SIZE];
+uint32_t NVS_SIM_u32Erases[NVS_NUM_SECTORS];   //wear
+uint32_t NVS_SIM_u32FlashTime = 0;              //modelled uS spent erasing and programming
+uint32_t NVS_SIM_u32Overwrites = 0;             //bytes written over bits that weren't erased
+int32_t NVS_SIM_i32Budget = -1;                 //bytes until the power is cut, -1 for never
+boolean NVS_SIM_btPowerOff = false;
+uint32_t NVS_SIM_u32CutErases = 0;              //where the power cuts landed
+uint32_t NVS_SIM_u32CutHeaders = 0;             //in a sector header write, the last step of a compaction
+uint32_t NVS_SIM_u32CutRecords = 0;
+
+static boolean NVS_SIM_Read(unsigned char ucSector, uint32_t u32Offset, void *pvData, uint32_t u32Length)
+{
+  if (NVS_SIM_btPowerOff)
+  {
+    return (false);
+  }
+  memcpy(pvData, &NVS_SIM_ucFlash[ucSector][u32Offset], u32Length);
+  return (true);
+}
+
+static boolean NVS_SIM_Write(unsigned char ucSector, uint32_t u32Offset, const void *pvData, uint32_t u32Length)
+{
+  const uint8_t *pucData = (const uint8_t *)pvData;
+  uint8_t *pucFlash = &NVS_SIM_ucFlash[ucSector][u32Offset];
+
+  for (uint32_t u32I = 0; u32I < u32Length; u32I++)
+  {
+    if (NVS_SIM_btPowerOff)
+    {
+      return (false);
+    }
+    if (NVS_SIM_i32Budget == 0)
+    {
+      if (u32Offset + u32I < sizeof(NVS_SectorHeader))
+      {
+        NVS_SIM_u32CutHeaders++;
+      }
+      else
+      {
+        NVS_SIM_u32CutRecords++;
+      }
+      pucFlash[u32I] &= pucData[u32I] | random(256);   //only some of the bits got programmed
+      NVS_SIM_btPowerOff = true;
+      return (false);
+    }
+    if (NVS_SIM_i32Budget > 0)
+    {
+      NVS_SIM_i32Budget--;
+    }
+    if ((pucFlash[u32I] & pucData[u32I]) != pucData[u32I])
+    {
+      NVS_SIM_u32Overwrites++;
+    }
+    pucFlash[u32I] &= pucData[u32I];
+    NVS_SIM_u32FlashTime += NVS_SIM_PROGRAM_US_PER_BYTE;
+  }
+  return (true);
+}
+
+static boolean NVS_SIM_Erase(unsigned char ucSector)
+{
+  if (NVS_SIM_btPowerOff)
+  {
+    return (false);
+  }
+  NVS_SIM_u32Erases[ucSector]++;
+  if (NVS_SIM_i32Budget == 0)
+  {
+    NVS_SIM_u32CutErases++;
+    memset(NVS_SIM_ucFlash[ucSector], 0xFF, random(NVS_SECTOR_SIZE));
+    NVS_SIM_btPowerOff = true;
+    return (false);
+  }
+  if (NVS_SIM_i32Budget > 0)
+  {
+    NVS_SIM_i32Budget--;
+  }
+  memset(NVS_SIM_ucFlash[ucSector], 0xFF, NVS_SECTOR_SIZE);
+  NVS_SIM_u32FlashTime += NVS_SIM_ERASE_US;
+  return (true);
+}
+
+//blank emulated flash, the NVS uses it from the next NVS_Init
+void NVS_SIM_Install()
+{
+  memset(NVS_SIM_ucFlash, 0xFF, sizeof(NVS_SIM_ucFlash));
+  memset(NVS_SIM_u32Erases, 0, sizeof(NVS_SIM_u32Erases));
+  NVS_SIM_i32Budget = -1;
+  NVS_SIM_btPowerOff = false;
+  NVS_tFlash.btRead = NVS_SIM_Read;
+  NVS_tFlash.btWrite = NVS_SIM_Write;
+  NVS_tFlash.btErase = NVS_SIM_Erase;
+}
+
+//true if the RAM copy holds exactly the values in i32Values (where btStored)
+static boolean NVS_SIM_Matches(const int32_t *i32Values, const boolean *btStored)
+{
+  for (unsigned int uiKey = 0; uiKey < NVS_MAX_KEYS; uiKey++)
+  {
+    if ((NVS_Exists(uiKey) != btStored[uiKey]) || (btStored[uiKey] && (NVS_ReadLong(uiKey) != i32Values[uiKey])))
+    {
+      return (false);
+    }
+  }
+  return (true);
+}
+
+//bytes (an erase counts as one) the next NVS_WriteCommit will write, with the values in uiKeys already stored
+//btCompacts is set if it erases a sector
+//the commit is written and then undone: the flash and its statistics are put back, the RAM copy is reloaded from the flash
+//(what a reset would see, the commits before this one in the boot all completed) and the values are stored again
+static uint32_t NVS_SIM_MeasureCommit(const unsigned int *uiKeys, const int32_t *i32Values, unsigned char ucStores, boolean &btCompacts)
+{
+  static uint8_t ucSaved[NVS_NUM_SECTORS][NVS_SECTOR_SIZE];
+  uint32_t u32Erases[NVS_NUM_SECTORS];
+  uint32_t u32FlashTime = NVS_SIM_u32FlashTime;
+  uint32_t u32Overwrites = NVS_SIM_u32Overwrites;
+  uint32_t u32Length;
+
+  memcpy(ucSaved, NVS_SIM_ucFlash, sizeof(ucSaved));
+  memcpy(u32Erases, NVS_SIM_u32Erases, sizeof(u32Erases));
+
+  NVS_SIM_i32Budget = INT32_MAX;
+  NVS_WriteCommit();
+  u32Length = INT32_MAX - NVS_SIM_i32Budget;
+  NVS_SIM_i32Budget = -1;
+  btCompacts = memcmp(u32Erases, NVS_SIM_u32Erases, sizeof(u32Erases)) != 0;
+
+  memcpy(NVS_SIM_ucFlash, ucSaved, sizeof(ucSaved));
+  memcpy(NVS_SIM_u32Erases, u32Erases, sizeof(u32Erases));
+  NVS_SIM_u32FlashTime = u32FlashTime;
+  NVS_SIM_u32Overwrites = u32Overwrites;
+  NVS_Load();
+  for (unsigned char ucStore = 0; ucStore < ucStores; ucStore++)
+  {
+    NVS_StoreLong(uiKeys[ucStore], i32Values[ucStore]);
+  }
+  return (u32Length);
+}
+
+//power loss test, leaves the NVS on blank emulated flash, returns the number of boots that came up inconsistent
+unsigned int NVS_SIM_Run(unsigned int uiBoots)
+{
+  int32_t i32Committed[NVS_MAX_KEYS];         //last commit known to be complete
+  boolean btCommitted[NVS_MAX_KEYS] = {false};
+  int32_t i32CutOff[NVS_MAX_KEYS];            //commit the power was cut during, either this or the one before is fine
+  boolean btCutOff[NVS_MAX_KEYS];
+  boolean btWasCut = false;
+  unsigned int uiInconsistent = 0;
+  unsigned int uiCuts = 0;
+  unsigned int uiCutsKept = 0;                //cut off commits that made it into the flash anyway
+  unsigned int uiCompactionCuts = 0;
+  uint32_t u32Commits = 0;
+  uint32_t u32Erases = 0;
+  uint32_t u32CommitTime = 0;                 //uS, CPU plus modelled flash time
+  uint32_t u32MaxCommitTime = 0;
+  uint32_t u32ScanTime = 0;
+  uint32_t u32MaxScanTime = 0;
+
+  NVS_SIM_Install();
+  NVS_SIM_u32Overwrites = 0;
+  NVS_SIM_u32CutErases = 0;
+  NVS_SIM_u32CutHeaders = 0;
+  NVS_SIM_u32CutRecords = 0;
+
+  for (unsigned int uiBoot = 0; uiBoot < uiBoots; uiBoot++)
+  {
+    NVS_SIM_btPowerOff = false;
+    NVS_SIM_i32Budget = -1;
+
+    uint32_t u32Start = micros();
+    NVS_Load();
+    uint32_t u32Time = micros() - u32Start;
+    u32ScanTime += u32Time;
+    u32MaxScanTime = max(u32MaxScanTime, u32Time);
+
+    if (btWasCut && NVS_SIM_Matches(i32CutOff, btCutOff))
+    {
+      memcpy(i32Committed, i32CutOff, sizeof(i32Committed));
+      memcpy(btCommitted, btCutOff, sizeof(btCommitted));
+      uiCutsKept++;
+    }
+    else if (!NVS_SIM_Matches(i32Committed, btCommitted))
+    {
+      uiInconsistent++;
+      Serial.printf(" nvs sim boot %u came up inconsistent\n", uiBoot);
+      memset(btCommitted, 0, sizeof(btCommitted));   //start again from what is in the flash
+      for (unsigned int uiKey = 0; uiKey < NVS_MAX_KEYS; uiKey++)
+      {
+        btCommitted[uiKey] = NVS_Exists(uiKey);
+        i32Committed[uiKey] = NVS_ReadLong(uiKey);
+      }
+    }
+    btWasCut = false;
+
+    for (unsigned char ucCommit = 0; ucCommit < NVS_SIM_COMMITS; ucCommit++)
+    {
+      unsigned int uiKeys[NVS_SIM_MAX_STORES];
+      int32_t i32Values[NVS_SIM_MAX_STORES];
+      unsigned char ucStores = random(1, NVS_SIM_MAX_STORES + 1);
+
+      memcpy(i32CutOff, i32Committed, sizeof(i32CutOff));
+      memcpy(btCutOff, btCommitted, sizeof(btCutOff));
+      for (unsigned char ucStore = 0; ucStore < ucStores; ucStore++)
+      {
+        uiKeys[ucStore] = random(NVS_MAX_KEYS);
+        i32Values[ucStore] = random(0x7FFFFFFF);
+
+        NVS_StoreLong(uiKeys[ucStore], i32Values[ucStore]);
+        i32CutOff[uiKeys[ucStore]] = i32Values[ucStore];
+        btCutOff[uiKeys[ucStore]] = true;
+      }
+
+      boolean btCompacts;
+      uint32_t u32Length = NVS_SIM_MeasureCommit(uiKeys, i32Values, ucStores, btCompacts);
+
+      if (random(btCompacts ? NVS_SIM_COMPACTION_CUT : NVS_SIM_APPEND_CUT) == 0)
+      {
+        NVS_SIM_i32Budget = random(u32Length);
+        uiCompactionCuts += btCompacts;
+      }
+
+      uint32_t u32Erased = NVS_SIM_u32Erases[0] + NVS_SIM_u32Erases[1] + NVS_SIM_u32Erases[2];
+      uint32_t u32FlashTime = NVS_SIM_u32FlashTime;
+      u32Start = micros();
+      boolean btOk = NVS_WriteCommit();
+      u32Time = (micros() - u32Start) + (NVS_SIM_u32FlashTime - u32FlashTime);
+
+      if (!btOk || NVS_SIM_btPowerOff)
+      {
+        btWasCut = true;
+        uiCuts++;
+        break;
+      }
+      memcpy(i32Committed, i32CutOff, sizeof(i32Committed));
+      memcpy(btCommitted, btCutOff, sizeof(btCommitted));
+      u32Commits++;
+      u32Erases += NVS_SIM_u32Erases[0] + NVS_SIM_u32Erases[1] + NVS_SIM_u32Erases[2] - u32Erased;
+      u32CommitTime += u32Time;
+      u32MaxCommitTime = max(u32MaxCommitTime, u32Time);
+    }
+  }
+
+  Serial.printf("NVS sim %u boots, %u inconsistent, %u power cuts (%u during compactions, %u commits kept), %lu overwrites\n", uiBoots,
+                uiInconsistent, uiCuts, uiCompactionCuts, uiCutsKept, (unsigned long)NVS_SIM_u32Overwrites);
+  Serial.printf(" cuts in an erase %lu, a sector header %lu, records %lu\n", (unsigned long)NVS_SIM_u32CutErases,
+                (unsigned long)NVS_SIM_u32CutHeaders, (unsigned long)NVS_SIM_u32CutRecords);
+  if (u32Commits != 0)
+  {
+    Serial.printf(" %lu commits, %lu.%03lu erases per commit, commit %lu uS average %lu uS worst\n", (unsigned long)u32Commits,
+                  (unsigned long)(u32Erases / u32Commits), (unsigned long)((u32Erases * 1000UL / u32Commits) % 1000),
+                  (unsigned long)(u32CommitTime / u32Commits), (unsigned long)u32MaxCommitTime);
+  }
+  Serial.printf(" boot scan %lu uS average %lu uS worst, sector erases %lu %lu %lu\n", (unsigned long)(u32ScanTime / max(uiBoots, 1U)),
+                (unsigned long)u32MaxScanTime, (unsigned long)NVS_SIM_u32Erases[0], (unsigned long)NVS_SIM_u32Erases[1],
+                (unsigned long)NVS_SIM_u32Erases[2]);
+
+  NVS_SIM_Install();
+  return (uiInconsistent);
+}
+
+#endif
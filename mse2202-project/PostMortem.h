@@ -0,0 +1,175 @@
+/*
+  MSE 2202 Team 2
+
+  \Post mortem log in RTC slow memory
+
+  keeps the last few watchdog overruns, state machine changes and resets in RTC memory, which isn't cleared by a
+  panic, watchdog or brownout reset, so after the robot resets mid run the log shows what it was doing
+  the log is printed at boot and served at http://192.168.128.1/postmortem
+
+  each core writes its own ring (core 0 its watchdog overruns and supervisor trips, core 1 its overruns, state changes and boot records)
+  so every ring has one writer and no locks are needed, a record is only counted once it's completely written
+  the log is cleared on power up and if the magic number doesn't match
+*/
+
+#ifndef POSTMORTEM_H
+#define POSTMORTEM_H 1
+
+#define PM_MAGIC 0x504D3032
+#define PM_NUM_RECORDS 32              //records per core, must be a power of 2
+
+#define PM_BOOT 1                      //u32Value is the reset reason
+#define PM_OVERRUN 2                   //ucCase is the watchdog case index, u32Value the CPU cycles between feeds
+#define PM_STATE 3                     //drive or climb state machine changed state
+#define PM_SUPERVISOR 4                //the deadline supervisor cut the motors, ucCase is the core 1 loop stage that was stuck
+
+struct PM_Record
+{
+  uint32_t u32Time;                    //millis() when recorded
+  uint32_t u32Value;
+  unsigned char ucType;
+  unsigned char ucCase;
+  unsigned char ucDriveState;          //state machines when recorded
+  unsigned char ucClimbState;
+  unsigned char ucManeuver;
+  unsigned char ucBoot;                //low byte of the boot count, to tell runs apart
+};
+
+struct PM_Log
+{
+  uint32_t u32Magic;
+  uint32_t u32Boot;                    //boots since the log was cleared
+  uint32_t u32Head[2];                 //records written by each core, the next one goes in u32Head % PM_NUM_RECORDS
+  PM_Record tRecords[2][PM_NUM_RECORDS];
+};
+
+RTC_NOINIT_ATTR PM_Log PM_tLog;
+
+//current state machine states, copied into every record
+volatile unsigned char PM_vucDriveState = 0;
+volatile unsigned char PM_vucClimbState = 0;
+volatile unsigned char PM_vucManeuver = 0;
+
+static void PM_Write(unsigned char ucCore, unsigned char ucType, unsigned char ucCase, uint32_t u32Value)
+{
+  uint32_t u32Head = PM_tLog.u32Head[ucCore];
+  PM_Record *ptRecord = &PM_tLog.tRecords[ucCore][u32Head & (PM_NUM_RECORDS - 1)];
+
+  ptRecord->u32Time = millis();
+  ptRecord->u32Value = u32Value;
+  ptRecord->ucType = ucType;
+  ptRecord->ucCase = ucCase;
+  ptRecord->ucDriveState = PM_vucDriveState;
+  ptRecord->ucClimbState = PM_vucClimbState;
+  ptRecord->ucManeuver = PM_vucManeuver;
+  ptRecord->ucBoot = PM_tLog.u32Boot;
+  __atomic_store_n(&PM_tLog.u32Head[ucCore], u32Head + 1, __ATOMIC_RELEASE);   //count the record after it's written
+}
+
+//watchdog overrun, called from the feed of the core that overran
+void PM_Overrun(unsigned char ucCore, unsigned char ucCase, uint32_t u32Cycles)
+{
+  PM_Write(ucCore, PM_OVERRUN, ucCase, u32Cycles);
+}
+
+//deadline supervisor trip, called from core 0
+void PM_Supervisor(unsigned char ucStage)
+{
+  PM_Write(0, PM_SUPERVISOR, ucStage, 0);
+}
+
+//state machine changes, called from the control task (core 1)
+void PM_DriveState(unsigned char ucDriveState, unsigned char ucManeuver)
+{
+  PM_vucDriveState = ucDriveState;
+  PM_vucManeuver = ucManeuver;
+  PM_Write(1, PM_STATE, 0, 0);
+}
+
+void PM_ClimbState(unsigned char ucClimbState)
+{
+  PM_vucClimbState = ucClimbState;
+  PM_Write(1, PM_STATE, 0, 0);
+}
+
+static const char *PM_ResetReason(uint32_t u32Reason)
+{
+  switch (u32Reason)
+  {
+    case ESP_RST_POWERON:  return ("power on");
+    case ESP_RST_EXT:      return ("external pin");
+    case ESP_RST_SW:       return ("software");
+    case ESP_RST_PANIC:    return ("panic");
+    case ESP_RST_INT_WDT:  return ("interrupt watchdog");
+    case ESP_RST_TASK_WDT: return ("task watchdog");
+    case ESP_RST_WDT:      return ("other watchdog");
+    case ESP_RST_BROWNOUT: return ("brownout");
+    default:               return ("unknown");
+  }
+}
+
+//whole log as text, oldest record first, core 0 and core 1 rings one after the other
+String PM_Report()
+{
+  String strReport;
+  char cLine[96];
+
+  strReport.reserve(2 * PM_NUM_RECORDS * 64 + 128);
+  snprintf(cLine, sizeof(cLine), "post mortem log, boot %lu, drive/climb/maneuver are the states when recorded\n", (unsigned long)PM_tLog.u32Boot);
+  strReport += cLine;
+
+  for (unsigned char ucCore = 0; ucCore < 2; ucCore++)
+  {
+    uint32_t u32Head = __atomic_load_n(&PM_tLog.u32Head[ucCore], __ATOMIC_ACQUIRE);
+    uint32_t u32Count = min(u32Head, (uint32_t)PM_NUM_RECORDS);
+
+    snprintf(cLine, sizeof(cLine), "core %u, %lu records\n", ucCore, (unsigned long)u32Head);
+    strReport += cLine;
+    for (uint32_t u32I = u32Head - u32Count; u32I != u32Head; u32I++)
+    {
+      PM_Record *ptRecord = &PM_tLog.tRecords[ucCore][u32I & (PM_NUM_RECORDS - 1)];
+      int iLength = snprintf(cLine, sizeof(cLine), "boot %3u %8lu mS  drive %u climb %u maneuver %2u  ", ptRecord->ucBoot,
+                             (unsigned long)ptRecord->u32Time, ptRecord->ucDriveState, ptRecord->ucClimbState, ptRecord->ucManeuver);
+
+      switch (ptRecord->ucType)
+      {
+        case PM_BOOT:
+          snprintf(cLine + iLength, sizeof(cLine) - iLength, "BOOT reset by %s\n", PM_ResetReason(ptRecord->u32Value));
+          break;
+        case PM_OVERRUN:
+          snprintf(cLine + iLength, sizeof(cLine) - iLength, "OVERRUN case %u %lu uS\n", ptRecord->ucCase, (unsigned long)(ptRecord->u32Value / 240));
+          break;
+        case PM_SUPERVISOR:
+          snprintf(cLine + iLength, sizeof(cLine) - iLength, "MOTORS CUT stuck in case %u\n", ptRecord->ucCase);
+          break;
+        default:
+          snprintf(cLine + iLength, sizeof(cLine) - iLength, "STATE\n");
+          break;
+      }
+      strReport += cLine;
+    }
+  }
+  return (strReport);
+}
+
+//call once at the start of setup, prints what the log held before this boot then records the boot
+void PM_Init()
+{
+  esp_reset_reason_t eReason = esp_reset_reason();
+
+  if ((PM_tLog.u32Magic != PM_MAGIC) || (eReason == ESP_RST_POWERON))
+  {
+    memset(&PM_tLog, 0, sizeof(PM_tLog));
+    PM_tLog.u32Magic = PM_MAGIC;
+  }
+  else
+  {
+    Serial.print(PM_Report());
+  }
+
+  PM_tLog.u32Boot++;
+  PM_Write(1, PM_BOOT, 0, eReason);
+  Serial.printf("Reset by %s, boot %lu\n", PM_ResetReason(eReason), (unsigned long)PM_tLog.u32Boot);
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*
+  MSE 2202 Team 2
+
+  \Execution time profiler
+
+  usage
+  register each stage once at startup with PRF_Register("name"), it returns the stage index
+  time the stage with ccount, either PRF_Record(stage, cycles) or PRF_Lap(stage, mark) for back to back stages
+  each stage keeps min/max/mean and a fixed size log bucketed histogram (quantile sketch) for the p99, no allocation after startup
+  a stage should only be recorded from one core, the report can be read from either
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H 1
+
+#define PRF_MAX_STAGES 16
+#define PRF_SUB_BUCKET_BITS 2                                   //4 sub buckets per power of 2, max quantile error 25%
+#define PRF_BUCKETS ((33 - PRF_SUB_BUCKET_BITS) << PRF_SUB_BUCKET_BITS)
+#define PRF_CYCLES_PER_MICROSECOND 240
+
+struct PRF_Stage
+{
+  const char *strName;
+  uint32_t u32Count;
+  uint32_t u32Min;
+  uint32_t u32Max;
+  uint64_t u64Sum;
+  uint32_t u32Buckets[PRF_BUCKETS];
+};
+
+PRF_Stage PRF_Stages[PRF_MAX_STAGES];
+volatile unsigned char PRF_ucNumStages = 0;
+portMUX_TYPE PRF_pmtRegisterMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t PRF_Now()
+{
+  uint32_t u32Now;
+  asm volatile("esync; rsr %0,ccount":"=a" (u32Now)); // @ 240mHz clock each tick is ~4nS
+  return u32Now;
+}
+
+void PRF_Reset(unsigned char ucStage)
+{
+  PRF_Stage *ptStage = &PRF_Stages[ucStage];
+
+  ptStage->u32Count = 0;
+  ptStage->u32Min = 0xFFFFFFFF;
+  ptStage->u32Max = 0;
+  ptStage->u64Sum = 0;
+  memset(ptStage->u32Buckets, 0, sizeof(ptStage->u32Buckets));
+}
+
+//returns the new stage index, or PRF_MAX_STAGES if the table is full (recording to it is then ignored)
+unsigned char PRF_Register(const char *strName)
+{
+  unsigned char ucStage;
+
+  portENTER_CRITICAL(&PRF_pmtRegisterMux);
+  ucStage = PRF_ucNumStages;
+  if (ucStage < PRF_MAX_STAGES)
+  {
+    PRF_ucNumStages = ucStage + 1;
+  }
+  portEXIT_CRITICAL(&PRF_pmtRegisterMux);
+
+  if (ucStage < PRF_MAX_STAGES)
+  {
+    PRF_Stages[ucStage].strName = strName;
+    PRF_Reset(ucStage);
+  }
+  return (ucStage);
+}
+
+//values below 2^sub bits get their own bucket, above that each power of 2 is split into 2^sub bits buckets
+static inline unsigned int PRF_Bucket(uint32_t u32Cycles)
+{
+  if (u32Cycles < (1 << PRF_SUB_BUCKET_BITS))
+  {
+    return (u32Cycles);
+  }
+  unsigned int uiExponent = 31 - __builtin_clz(u32Cycles);
+  unsigned int uiSub = (u32Cycles >> (uiExponent - PRF_SUB_BUCKET_BITS)) & ((1 << PRF_SUB_BUCKET_BITS) - 1);
+  return (((uiExponent - PRF_SUB_BUCKET_BITS + 1) << PRF_SUB_BUCKET_BITS) + uiSub);
+}
+
+//smallest value that falls in the bucket after the given one, used as the bucket's reported value
+static inline uint32_t PRF_BucketLimit(unsigned int uiBucket)
+{
+  if (uiBucket < (1 << PRF_SUB_BUCKET_BITS))
+  {
+    return (uiBucket + 1);
+  }
+  unsigned int uiExponent = (uiBucket >> PRF_SUB_BUCKET_BITS) + PRF_SUB_BUCKET_BITS - 1;
+  unsigned int uiSub = uiBucket & ((1 << PRF_SUB_BUCKET_BITS) - 1);
+  uint64_t u64Limit = (uint64_t)((1 << PRF_SUB_BUCKET_BITS) + uiSub + 1) << (uiExponent - PRF_SUB_BUCKET_BITS);
+  return ((uint32_t)min(u64Limit, (uint64_t)0xFFFFFFFF));
+}
+
+void PRF_Record(unsigned char ucStage, uint32_t u32Cycles)
+{
+  if (ucStage >= PRF_MAX_STAGES)
+  {
+    return;
+  }
+  PRF_Stage *ptStage = &PRF_Stages[ucStage];
+
+  ptStage->u32Count++;
+  ptStage->u64Sum += u32Cycles;
+  if (u32Cycles < ptStage->u32Min)
+  {
+    ptStage->u32Min = u32Cycles;
+  }
+  if (u32Cycles > ptStage->u32Max)
+  {
+    ptStage->u32Max = u32Cycles;
+  }
+  ptStage->u32Buckets[PRF_Bucket(u32Cycles)]++;
+}
+
+//record the time since the mark and move the mark to now, for timing stages that run back to back
+void PRF_Lap(unsigned char ucStage, uint32_t &u32Mark)
+{
+  uint32_t u32Now = PRF_Now();
+
+  PRF_Record(ucStage, u32Now - u32Mark);
+  u32Mark = u32Now;
+}
+
+//quantile in thousandths (990 = p99), in cycles, clamped to the recorded max
+uint32_t PRF_Quantile(unsigned char ucStage, unsigned int uiPerMille)
+{
+  PRF_Stage *ptStage = &PRF_Stages[ucStage];
+  uint32_t u32Rank = ((uint64_t)ptStage->u32Count * uiPerMille + 999) / 1000;
+  uint32_t u32Seen = 0;
+
+  for (unsigned int uiBucket = 0; uiBucket < PRF_BUCKETS; uiBucket++)
+  {
+    u32Seen += ptStage->u32Buckets[uiBucket];
+    if ((u32Seen >= u32Rank) && (u32Seen != 0))
+    {
+      return (min(PRF_BucketLimit(uiBucket), ptStage->u32Max));
+    }
+  }
+  return (ptStage->u32Max);
+}
+
+uint32_t PRF_Mean(unsigned char ucStage)
+{
+  PRF_Stage *ptStage = &PRF_Stages[ucStage];
+
+  if (ptStage->u32Count == 0)
+  {
+    return (0);
+  }
+  return (ptStage->u64Sum / ptStage->u32Count);
+}
+
+void PRF_Print()
+{
+  Serial.println("Stage                count     min uS    mean uS     max uS     p99 uS");
+  for (unsigned char ucStage = 0; ucStage < PRF_ucNumStages; ucStage++)
+  {
+    PRF_Stage *ptStage = &PRF_Stages[ucStage];
+    if (ptStage->u32Count == 0)
+    {
+      continue;
+    }
+    Serial.printf("%-16s %9u %10.2f %10.2f %10.2f %10.2f\n", ptStage->strName, ptStage->u32Count,
+                  (float)ptStage->u32Min / PRF_CYCLES_PER_MICROSECOND,
+                  (float)PRF_Mean(ucStage) / PRF_CYCLES_PER_MICROSECOND,
+                  (float)ptStage->u32Max / PRF_CYCLES_PER_MICROSECOND,
+                  (float)PRF_Quantile(ucStage, 990) / PRF_CYCLES_PER_MICROSECOND);
+  }
+}
+
+//"P#^;name;count;min;mean;max;p99;...;END", times in cycles, sent to the web page on request
+String PRF_Report()
+{
+  String strReport = "P#^;";
+
+  for (unsigned char ucStage = 0; ucStage < PRF_ucNumStages; ucStage++)
+  {
+    PRF_Stage *ptStage = &PRF_Stages[ucStage];
+    strReport += String(ptStage->strName) + ";" + String(ptStage->u32Count) + ";"
+                 + String(ptStage->u32Count ? ptStage->u32Min : 0) + ";" + String(PRF_Mean(ucStage)) + ";"
+                 + String(ptStage->u32Max) + ";" + String(PRF_Quantile(ucStage, 990)) + ";";
+  }
+  strReport += "END";
+  return (strReport);
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+  MSE 2202 Team 2
+
+  \Lock free single producer / single consumer queue
+
+  usage
+  RB_Queue<item type, size> qName;   size must be a power of 2
+  one core (or ISR) only calls Push, the other only calls Pop
+  Push never blocks, if the queue is full the item is dropped and counted in u32Dropped
+*/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H 1
+
+template <typename T, unsigned int N>
+struct RB_Queue
+{
+  static_assert((N & (N - 1)) == 0, "RB_Queue size must be a power of 2");
+
+  T tItems[N];
+  volatile uint32_t u32Head;      //next slot to write, only written by the producer
+  volatile uint32_t u32Tail;      //next slot to read, only written by the consumer
+  volatile uint32_t u32Dropped;   //items pushed while the queue was full
+
+  bool Push(const T &tItem)
+  {
+    uint32_t u32LocalHead = __atomic_load_n(&u32Head, __ATOMIC_RELAXED);
+
+    if ((u32LocalHead - __atomic_load_n(&u32Tail, __ATOMIC_ACQUIRE)) >= N)
+    {
+      u32Dropped = u32Dropped + 1;
+      return (false);
+    }
+    tItems[u32LocalHead & (N - 1)] = tItem;
+    __atomic_store_n(&u32Head, u32LocalHead + 1, __ATOMIC_RELEASE);   //publish the item after it's written
+    return (true);
+  }
+
+  bool Pop(T &tItem)
+  {
+    uint32_t u32LocalTail = __atomic_load_n(&u32Tail, __ATOMIC_RELAXED);
+
+    if (u32LocalTail == __atomic_load_n(&u32Head, __ATOMIC_ACQUIRE))
+    {
+      return (false);
+    }
+    tItem = tItems[u32LocalTail & (N - 1)];
+    __atomic_store_n(&u32Tail, u32LocalTail + 1, __ATOMIC_RELEASE);   //free the slot after it's read
+    return (true);
+  }
+
+  unsigned int Count()
+  {
+    return (__atomic_load_n(&u32Head, __ATOMIC_ACQUIRE) - __atomic_load_n(&u32Tail, __ATOMIC_ACQUIRE));
+  }
+};
+
+#endif
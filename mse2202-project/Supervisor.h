@@ -0,0 +1,129 @@
+/*
+  MSE 2202 Team 2
+
+  \Control loop deadline supervisor
+
+  the control task (loop() on core 1) checks in with SUP_CheckIn every pass while the motors can be running
+  hardware timer 3 (timers 0 and 1 are the watchdogs, 2 debounces the climb limit switch) interrupts every SUP_PERIOD_US on core 0
+  if the control task has missed SUP_MAX_MISSED periods in a row the ISR cuts every motor LEDC channel (drive 1 to 4, climb 5 and 6)
+  the WDT.h watchdogs only record an overrun, this stops the robot when the control task hangs (blocked serial, breakpoint halt, ...)
+
+  the motors are cut by disabling the LEDC channel outputs in the LEDC registers, so the ISR doesn't call any flash code
+  a ledcWrite on a channel would enable its output again, so the trip is latched until the control task acknowledges it
+  with SUP_Tripped at the top of its next pass, and the drive and climb motor writers skip their ledcWrite while SUP_MotorsCut,
+  the rest of the stalled pass can't start the motors again before the state machines are stopped
+  SUP_Check on core 0 reports each trip over serial and in the post mortem log
+*/
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H 1
+
+#include <soc/ledc_struct.h>
+#include "PostMortem.h"
+#include "WDT.h"
+
+#define SUP_TIMER 3
+#define SUP_PERIOD_US 5000               //check in period
+#define SUP_MAX_MISSED 4                 //missed periods in a row before the motors are cut
+#define SUP_FIRST_CHANNEL 1              //motor LEDC channels, all in the high speed group
+#define SUP_LAST_CHANNEL 6
+
+hw_timer_t *SUP_htTimer = NULL;
+
+volatile boolean SUP_vbEnabled = false;         //only supervise while the motors can be running
+volatile boolean SUP_vbCheckedIn = false;       //set by the control task, cleared by the ISR
+volatile unsigned char SUP_vucMissed = 0;
+volatile uint32_t SUP_vu32Trips = 0;            //only written by the ISR
+volatile unsigned char SUP_vucTripStage = 0;    //core 1 watchdog case index (loop stage) the control task was stuck in
+
+uint32_t SUP_u32TripsSeenCore0 = 0;             //trips already reported by SUP_Check
+uint32_t SUP_u32TripsSeenCore1 = 0;             //trips already handled by SUP_Tripped
+
+void IRAM_ATTR SUP_TimerISR()
+{
+  if (!SUP_vbEnabled)
+  {
+    SUP_vucMissed = 0;
+    return;
+  }
+  if (SUP_vbCheckedIn)
+  {
+    SUP_vbCheckedIn = false;
+    SUP_vucMissed = 0;
+    return;
+  }
+
+  SUP_vucMissed = SUP_vucMissed + 1;
+  if (SUP_vucMissed >= SUP_MAX_MISSED)
+  {
+    SUP_vucTripStage = WDT_ucCaseIndexCore1;
+    SUP_vu32Trips = SUP_vu32Trips + 1;   //latches SUP_MotorsCut before the outputs are disabled
+    for (unsigned char ucChannel = SUP_FIRST_CHANNEL; ucChannel <= SUP_LAST_CHANNEL; ucChannel++)
+    {
+      LEDC.channel_group[0].channel[ucChannel].conf0.idle_lv = 0;
+      LEDC.channel_group[0].channel[ucChannel].conf0.sig_out_en = 0;
+    }
+    SUP_vbEnabled = false;
+    SUP_vucMissed = 0;
+  }
+}
+
+//call from core 0 so the supervisor keeps running when core 1 is stuck
+void SUP_Init()
+{
+  SUP_htTimer = timerBegin(SUP_TIMER, 80, true);   //1 uS ticks
+  timerAttachInterrupt(SUP_htTimer, &SUP_TimerISR, true);
+  timerAlarmWrite(SUP_htTimer, SUP_PERIOD_US, true);
+  timerAlarmEnable(SUP_htTimer);
+}
+
+//control task, every pass
+void SUP_CheckIn()
+{
+  SUP_vbCheckedIn = true;
+}
+
+//control task, turn supervision on while the drive or climb is running and off before sleeping with the motors stopped
+void SUP_Enable(boolean btEnable)
+{
+  if (btEnable && !SUP_vbEnabled)
+  {
+    SUP_vbCheckedIn = true;   //give the first period a check in so enabling late in a period doesn't count as a miss
+  }
+  SUP_vbEnabled = btEnable;
+}
+
+//true from a trip until the control task acknowledges it with SUP_Tripped, the motor writers skip ledcWrite while it is set
+//(a trip is latched as a count the control task hasn't seen, so a second trip during the acknowledgement can't be lost)
+boolean SUP_MotorsCut()
+{
+  return (SUP_vu32Trips != SUP_u32TripsSeenCore1);
+}
+
+//control task, true once for each trip and acknowledges it, stop the state machines straight after
+boolean SUP_Tripped()
+{
+  uint32_t u32Trips = SUP_vu32Trips;
+
+  if (u32Trips == SUP_u32TripsSeenCore1)
+  {
+    return (false);
+  }
+  SUP_u32TripsSeenCore1 = u32Trips;
+  return (true);
+}
+
+//core 0, report new trips
+void SUP_Check()
+{
+  uint32_t u32Trips = SUP_vu32Trips;
+
+  if (u32Trips != SUP_u32TripsSeenCore0)
+  {
+    SUP_u32TripsSeenCore0 = u32Trips;
+    PM_Supervisor(SUP_vucTripStage);
+    Serial.printf("SUP motors cut, control task missed %u deadlines in stage %u (%lu trips)\n", SUP_MAX_MISSED, SUP_vucTripStage, (unsigned long)u32Trips);
+  }
+}
+
+#endif
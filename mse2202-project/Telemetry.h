@@ -0,0 +1,74 @@
+/*
+  MSE 2202 Team 2
+
+  \Control to comms telemetry pipeline
+
+  Core 1 (control) publishes a snapshot of the control variables once per loop with TEL_Publish
+  Core 0 (networking) drains the queue with TEL_Receive and keeps the latest snapshot in the TEL_ mirror variables
+  the web page watch variables in "BreakPoint.h" read the mirrors, so every value shown comes from the same control loop pass
+  and core 0 never reads control variables while core 1 is half way through updating them
+  snapshots are received one at a time so the sampler in "BreakPoint.h" can see every control loop pass
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H 1
+
+#include "RingBuffer.h"
+
+struct TEL_Snapshot
+{
+  uint32_t u32Time;                     //millis() when the snapshot was taken
+  int iError1;
+  int32_t i32LeftOdometer;
+  int32_t i32RightOdometer;
+  uint16_t ui16LeftEncoderAMissed;
+  uint16_t ui16LeftEncoderBMissed;
+  uint16_t ui16RightEncoderAMissed;
+  uint16_t ui16RightEncoderBMissed;
+  uint32_t u32LeftEncoderAveTime;
+  uint32_t u32RightEncoderAveTime;
+};
+
+RB_Queue<TEL_Snapshot, 16> TEL_qControlToComms;
+
+//latest snapshot received on core 0
+uint32_t TEL_u32Time;
+int TEL_iError1;
+int32_t TEL_i32LeftOdometer;
+int32_t TEL_i32RightOdometer;
+uint16_t TEL_ui16LeftEncoderAMissed;
+uint16_t TEL_ui16LeftEncoderBMissed;
+uint16_t TEL_ui16RightEncoderAMissed;
+uint16_t TEL_ui16RightEncoderBMissed;
+uint32_t TEL_u32LeftEncoderAveTime;
+uint32_t TEL_u32RightEncoderAveTime;
+
+//core 1, never blocks, the snapshot is dropped if core 0 has fallen behind
+void TEL_Publish(const TEL_Snapshot &tSnapshot)
+{
+  TEL_qControlToComms.Push(tSnapshot);
+}
+
+//core 0, loads the oldest snapshot into the mirrors, returns false if there are none
+boolean TEL_Receive()
+{
+  TEL_Snapshot tSnapshot;
+
+  if (!TEL_qControlToComms.Pop(tSnapshot))
+  {
+    return (false);
+  }
+  TEL_u32Time = tSnapshot.u32Time;
+  TEL_iError1 = tSnapshot.iError1;
+  TEL_i32LeftOdometer = tSnapshot.i32LeftOdometer;
+  TEL_i32RightOdometer = tSnapshot.i32RightOdometer;
+  TEL_ui16LeftEncoderAMissed = tSnapshot.ui16LeftEncoderAMissed;
+  TEL_ui16LeftEncoderBMissed = tSnapshot.ui16LeftEncoderBMissed;
+  TEL_ui16RightEncoderAMissed = tSnapshot.ui16RightEncoderAMissed;
+  TEL_ui16RightEncoderBMissed = tSnapshot.ui16RightEncoderBMissed;
+  TEL_u32LeftEncoderAveTime = tSnapshot.u32LeftEncoderAveTime;
+  TEL_u32RightEncoderAveTime = tSnapshot.u32RightEncoderAveTime;
+  return (true);
+}
+
+#endif
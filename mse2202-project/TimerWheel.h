@@ -0,0 +1,336 @@
+/*
+  MSE 2202 Team 2
+
+  \Hierarchical timer wheel for state machine timeouts
+
+  usage
+  TMR_Timer tName = TMR_TIMER(callback);   callback is a void function(void), run from TMR_Service when the timer expires, or NULL for a plain timeout
+  TMR_Arm(&tName, microseconds) (re)starts the timer, TMR_Cancel(&tName) stops it, both O(1)
+  TMR_IsArmed(&tName) is true from arming until it expires or is cancelled
+  TMR_Service(micros()) is called by the control task every pass, TMR_ScheduleWake then wakes the control task at the next expiry
+  only use from the control task, nothing here is locked
+  a callback can arm timers, but shouldn't rearm its own with a 0 delay or it will run again in the same service
+
+  1 uS ticks, level 0 has 256 slots (256uS), levels 1 to 3 have 64 slots each (16mS, 1S, 67S)
+  all times are compared as signed differences so micros() wrapping every 71 minutes doesn't matter
+  timers longer than 67S are parked in the last level and moved down again each time it cascades
+  TMR_Service jumps straight to the next slot or cascade with timers in it, and an empty wheel is moved up to now,
+  so a service after the robot has been idle for any length of time costs the same as one after a single pass
+*/
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H 1
+
+#include <esp_timer.h>
+#include "Events.h"
+
+#define TMR_LEVEL0_BITS 8
+#define TMR_LEVEL0_SLOTS (1 << TMR_LEVEL0_BITS)
+#define TMR_LEVELN_BITS 6
+#define TMR_LEVELN_SLOTS (1 << TMR_LEVELN_BITS)
+#define TMR_UPPER_LEVELS 3
+#define TMR_MAX_DELAY ((1UL << (TMR_LEVEL0_BITS + TMR_UPPER_LEVELS * TMR_LEVELN_BITS)) - 1)
+
+#define TMR_TIMER(callback) {NULL, NULL, 0, callback, false, 0, 0}
+
+struct TMR_Timer
+{
+  TMR_Timer *ptNext;
+  TMR_Timer *ptPrev;
+  uint32_t u32Expiry;           //micros() at which the timer expires
+  void (*vfCallback)(void);
+  boolean btArmed;
+  unsigned char ucLevel;        //wheel level and slot the timer is linked into
+  unsigned char ucSlot;
+};
+
+TMR_Timer *TMR_ptLevel0[TMR_LEVEL0_SLOTS];
+TMR_Timer *TMR_ptLevelN[TMR_UPPER_LEVELS][TMR_LEVELN_SLOTS];
+uint32_t TMR_u32Level0Occupied[TMR_LEVEL0_SLOTS / 32];   //bit set for each slot with timers in it
+uint64_t TMR_u64LevelNOccupied[TMR_UPPER_LEVELS];
+uint32_t TMR_u32WheelTime;                               //every tick before this has been processed
+
+esp_timer_handle_t TMR_htWake = NULL;
+
+static void TMR_WakeCallback(void *pvArg)
+{
+  EVT_Post(EVT_TIMER);
+}
+
+static inline unsigned int TMR_Shift(unsigned char ucLevel)   //ucLevel 1 to 3
+{
+  return (TMR_LEVEL0_BITS + (ucLevel - 1) * TMR_LEVELN_BITS);
+}
+
+static inline TMR_Timer **TMR_SlotHead(unsigned char ucLevel, unsigned char ucSlot)
+{
+  return (ucLevel == 0 ? &TMR_ptLevel0[ucSlot] : &TMR_ptLevelN[ucLevel - 1][ucSlot]);
+}
+
+static void TMR_Link(TMR_Timer *ptTimer)
+{
+  int32_t i32Delta = ptTimer->u32Expiry - TMR_u32WheelTime;
+  uint32_t u32Expiry = ptTimer->u32Expiry;
+  TMR_Timer **pptHead;
+
+  if (i32Delta < 0)   //already due, goes in the slot that will be processed next
+  {
+    i32Delta = 0;
+    u32Expiry = TMR_u32WheelTime;
+  }
+  else if ((uint32_t)i32Delta > TMR_MAX_DELAY)
+  {
+    u32Expiry = TMR_u32WheelTime + TMR_MAX_DELAY;
+  }
+
+  if (i32Delta < TMR_LEVEL0_SLOTS)
+  {
+    ptTimer->ucLevel = 0;
+    ptTimer->ucSlot = u32Expiry & (TMR_LEVEL0_SLOTS - 1);
+    TMR_u32Level0Occupied[ptTimer->ucSlot >> 5] |= 1UL << (ptTimer->ucSlot & 31);
+  }
+  else
+  {
+    unsigned char ucLevel = 1;
+    while ((ucLevel < TMR_UPPER_LEVELS) && ((uint32_t)i32Delta >= (1UL << (TMR_Shift(ucLevel) + TMR_LEVELN_BITS))))
+    {
+      ucLevel++;
+    }
+    ptTimer->ucLevel = ucLevel;
+    ptTimer->ucSlot = (u32Expiry >> TMR_Shift(ucLevel)) & (TMR_LEVELN_SLOTS - 1);
+    TMR_u64LevelNOccupied[ucLevel - 1] |= 1ULL << ptTimer->ucSlot;
+  }
+
+  pptHead = TMR_SlotHead(ptTimer->ucLevel, ptTimer->ucSlot);
+  ptTimer->ptPrev = NULL;
+  ptTimer->ptNext = *pptHead;
+  if (*pptHead)
+  {
+    (*pptHead)->ptPrev = ptTimer;
+  }
+  *pptHead = ptTimer;
+}
+
+static void TMR_Unlink(TMR_Timer *ptTimer)
+{
+  TMR_Timer **pptHead = TMR_SlotHead(ptTimer->ucLevel, ptTimer->ucSlot);
+
+  if (ptTimer->ptPrev)
+  {
+    ptTimer->ptPrev->ptNext = ptTimer->ptNext;
+  }
+  else
+  {
+    *pptHead = ptTimer->ptNext;
+  }
+  if (ptTimer->ptNext)
+  {
+    ptTimer->ptNext->ptPrev = ptTimer->ptPrev;
+  }
+
+  if (*pptHead == NULL)
+  {
+    if (ptTimer->ucLevel == 0)
+    {
+      TMR_u32Level0Occupied[ptTimer->ucSlot >> 5] &= ~(1UL << (ptTimer->ucSlot & 31));
+    }
+    else
+    {
+      TMR_u64LevelNOccupied[ptTimer->ucLevel - 1] &= ~(1ULL << ptTimer->ucSlot);
+    }
+  }
+}
+
+void TMR_Init()
+{
+  esp_timer_create_args_t tWakeArgs = {};
+
+  TMR_u32WheelTime = micros();
+
+  tWakeArgs.callback = TMR_WakeCallback;
+  tWakeArgs.name = "TMR_Wake";
+  esp_timer_create(&tWakeArgs, &TMR_htWake);
+}
+
+//true if no timer is armed
+static boolean TMR_Empty()
+{
+  for (unsigned int uiWord = 0; uiWord < (TMR_LEVEL0_SLOTS / 32); uiWord++)
+  {
+    if (TMR_u32Level0Occupied[uiWord])
+    {
+      return (false);
+    }
+  }
+  for (unsigned char ucLevel = 0; ucLevel < TMR_UPPER_LEVELS; ucLevel++)
+  {
+    if (TMR_u64LevelNOccupied[ucLevel])
+    {
+      return (false);
+    }
+  }
+  return (true);
+}
+
+void TMR_Cancel(TMR_Timer *ptTimer)
+{
+  if (ptTimer->btArmed)
+  {
+    TMR_Unlink(ptTimer);
+    ptTimer->btArmed = false;
+  }
+}
+
+void TMR_Arm(TMR_Timer *ptTimer, uint32_t u32Microseconds)
+{
+  uint32_t u32Now = micros();
+
+  TMR_Cancel(ptTimer);
+  if (TMR_Empty())
+  {
+    TMR_u32WheelTime = u32Now;   //nothing to process in between, don't leave the wheel behind from an idle spell of any length
+  }
+  ptTimer->u32Expiry = u32Now + u32Microseconds;
+  ptTimer->btArmed = true;
+  TMR_Link(ptTimer);
+}
+
+boolean TMR_IsArmed(TMR_Timer *ptTimer)
+{
+  return (ptTimer->btArmed);
+}
+
+//move every timer in an upper level slot down to where it belongs now, returns the slot index
+static unsigned char TMR_Cascade(unsigned char ucLevel)
+{
+  unsigned char ucSlot = (TMR_u32WheelTime >> TMR_Shift(ucLevel)) & (TMR_LEVELN_SLOTS - 1);
+  TMR_Timer *ptTimer = TMR_ptLevelN[ucLevel - 1][ucSlot];
+
+  TMR_ptLevelN[ucLevel - 1][ucSlot] = NULL;
+  TMR_u64LevelNOccupied[ucLevel - 1] &= ~(1ULL << ucSlot);
+  while (ptTimer)
+  {
+    TMR_Timer *ptNext = ptTimer->ptNext;
+    TMR_Link(ptTimer);
+    ptTimer = ptNext;
+  }
+  return (ucSlot);
+}
+
+//first occupied level 0 slot at or after uiFrom, TMR_LEVEL0_SLOTS if there isn't one before the wheel wraps
+static unsigned int TMR_NextOccupied0(unsigned int uiFrom)
+{
+  for (unsigned int uiWord = uiFrom >> 5; uiWord < (TMR_LEVEL0_SLOTS / 32); uiWord++)
+  {
+    uint32_t u32Bits = TMR_u32Level0Occupied[uiWord];
+    if (uiWord == (uiFrom >> 5))
+    {
+      u32Bits &= ~((1UL << (uiFrom & 31)) - 1);
+    }
+    if (u32Bits)
+    {
+      return ((uiWord << 5) + __builtin_ctz(u32Bits));
+    }
+  }
+  return (TMR_LEVEL0_SLOTS);
+}
+
+uint32_t TMR_UntilNext();
+
+//run the callbacks of every timer that has expired by u32Now
+void TMR_Service(uint32_t u32Now)
+{
+  while ((int32_t)(u32Now - TMR_u32WheelTime) >= 0)
+  {
+    if (TMR_Empty())
+    {
+      TMR_u32WheelTime = u32Now + 1;   //nothing armed, every tick up to now is done
+      return;
+    }
+
+    if ((TMR_u32WheelTime & (TMR_LEVEL0_SLOTS - 1)) == 0)
+    {
+      for (unsigned char ucLevel = 1; (ucLevel <= TMR_UPPER_LEVELS) && (TMR_Cascade(ucLevel) == 0); ucLevel++)
+      {
+      }
+    }
+
+    //the slot is looked up each time, a callback arming a timer on an empty wheel moves the wheel time up to now
+    while (TMR_ptLevel0[TMR_u32WheelTime & (TMR_LEVEL0_SLOTS - 1)])
+    {
+      TMR_Timer *ptTimer = TMR_ptLevel0[TMR_u32WheelTime & (TMR_LEVEL0_SLOTS - 1)];
+      TMR_Unlink(ptTimer);
+      ptTimer->btArmed = false;
+      if (ptTimer->vfCallback)
+      {
+        ptTimer->vfCallback();
+      }
+    }
+
+    //jump straight to the next occupied slot or cascade with timers in it, or past now, whichever comes first
+    TMR_u32WheelTime++;
+    if ((int32_t)(u32Now - TMR_u32WheelTime) >= 0)
+    {
+      TMR_u32WheelTime += min(TMR_UntilNext(), (uint32_t)(u32Now - TMR_u32WheelTime + 1));
+    }
+  }
+}
+
+//microseconds from the wheel time until the wheel next has work to do (a level 0 timer or a cascade with timers in it)
+//0xFFFFFFFF if no timers are armed
+uint32_t TMR_UntilNext()
+{
+  unsigned int uiSlot = TMR_u32WheelTime & (TMR_LEVEL0_SLOTS - 1);
+  uint32_t u32Until = 0xFFFFFFFF;
+  unsigned int uiNext = TMR_NextOccupied0(uiSlot);
+
+  if (uiNext < TMR_LEVEL0_SLOTS)
+  {
+    u32Until = uiNext - uiSlot;
+  }
+  else if ((uiNext = TMR_NextOccupied0(0)) < uiSlot)   //due after level 0 wraps around
+  {
+    u32Until = uiNext + TMR_LEVEL0_SLOTS - uiSlot;
+  }
+
+  for (unsigned char ucLevel = 1; ucLevel <= TMR_UPPER_LEVELS; ucLevel++)
+  {
+    uint64_t u64Occupied = TMR_u64LevelNOccupied[ucLevel - 1];
+    unsigned int uiShift = TMR_Shift(ucLevel);
+    unsigned int uiCurrent = (TMR_u32WheelTime >> uiShift) & (TMR_LEVELN_SLOTS - 1);
+    unsigned int uiDistance;
+
+    if (u64Occupied == 0)
+    {
+      continue;
+    }
+    //rotate so bit 0 is the current slot, the current slot has already cascaded unless the wheel is right on its boundary
+    u64Occupied = (u64Occupied >> uiCurrent) | (uiCurrent ? (u64Occupied << (TMR_LEVELN_SLOTS - uiCurrent)) : 0);
+    if ((u64Occupied & 1) && ((TMR_u32WheelTime & ((1UL << uiShift) - 1)) == 0))
+    {
+      uiDistance = 0;
+    }
+    else
+    {
+      u64Occupied &= ~1ULL;
+      uiDistance = u64Occupied ? __builtin_ctzll(u64Occupied) : TMR_LEVELN_SLOTS;
+    }
+    u32Until = min(u32Until, (uint32_t)((((TMR_u32WheelTime >> uiShift) + uiDistance) << uiShift) - TMR_u32WheelTime));
+  }
+  return (u32Until);
+}
+
+//wake the control task with EVT_TIMER when the wheel next has work to do
+void TMR_ScheduleWake()
+{
+  uint32_t u32Until = TMR_UntilNext();
+
+  esp_timer_stop(TMR_htWake);
+  if (u32Until != 0xFFFFFFFF)
+  {
+    int32_t i32Wait = (int32_t)(TMR_u32WheelTime + u32Until - micros());   //the wheel can be a tick ahead of micros() after a service
+    esp_timer_start_once(TMR_htWake, (i32Wait > 0) ? i32Wait : 1);
+  }
+}
+
+#endif
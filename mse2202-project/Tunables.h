@@ -0,0 +1,269 @@
+/*
+  MSE 2202 Team 2
+
+  \Tunables registry
+
+  the gains and timings in "tuning.h" and "climb.h" are plain variables, the control code reads them directly (no lookup on the hot path)
+  TUN_Tunables lists each one with its name, type, range and version, the value it's compiled with is its default
+  TUN_Init loads the stored values from NVS at boot, a value outside its range is replaced by the default
+  if the list changes (names, types, order or a version) the stored values are dropped and the defaults are stored
+
+  changing a value without rebuilding
+  websocket command 'T' sends "T#^;name;value;min;max;...;END"
+  websocket command "U<name>;<value>" queues a new value for core 1, TUN_Service applies it between control loop passes
+  and queues an NVS commit for it
+
+  bump a tunable's version when its meaning or units change so an old stored value isn't loaded into it
+*/
+
+#ifndef TUNABLES_H
+#define TUNABLES_H 1
+
+#include "NVS.h"
+#include "Events.h"
+#include "RingBuffer.h"
+#include "tuning.h"
+#include "climb.h"
+
+enum TUN_Type
+{
+  TUN_INT,
+  TUN_LONG,
+  TUN_ULONG,
+  TUN_FLOAT,
+  TUN_DOUBLE
+};
+
+constexpr TUN_Type TUN_TypeOf(int *) { return (TUN_INT); }
+constexpr TUN_Type TUN_TypeOf(long *) { return (TUN_LONG); }
+constexpr TUN_Type TUN_TypeOf(unsigned long *) { return (TUN_ULONG); }
+constexpr TUN_Type TUN_TypeOf(float *) { return (TUN_FLOAT); }
+constexpr TUN_Type TUN_TypeOf(double *) { return (TUN_DOUBLE); }
+
+struct TUN_Tunable
+{
+  const char *strName;
+  TUN_Type eType;
+  void *pvValue;
+  double dMin;
+  double dMax;
+  unsigned char ucVersion;
+  double dDefault;             //filled in by TUN_Init from the compiled value
+};
+
+#define TUN_ENTRY(variable, min, max, version) {#variable, TUN_TypeOf(&variable), &variable, min, max, version, 0}
+
+TUN_Tunable TUN_Tunables[] =
+{
+  //variable                     min      max      version
+  TUN_ENTRY(brakePower,             0,      255,     1),
+  TUN_ENTRY(brakeTime,              0,     1000,     1),
+  TUN_ENTRY(drivekP,             -100,      100,     1),
+  TUN_ENTRY(drivekI,             -100,      100,     1),
+  TUN_ENTRY(driveSteerkP,        -100,      100,     1),
+  TUN_ENTRY(driveAccelTime,         1,     5000,     1),
+  TUN_ENTRY(turnkP,              -100,      100,     1),
+  TUN_ENTRY(turnkI,              -100,      100,     1),
+  TUN_ENTRY(turnAccelTime,          1,     5000,     1),
+
+  TUN_ENTRY(holdBasePower,          0,      255,     1),
+  TUN_ENTRY(upPower,                0,      255,     1),
+  TUN_ENTRY(downPower,           -255,        0,     1),
+  TUN_ENTRY(holdTime,               0,    60000,     1),
+  TUN_ENTRY(currentStallTime,       1,     5000,     1),
+  TUN_ENTRY(calibrationSettleTime,  0,     2000,     1),
+  TUN_ENTRY(calibrationTime,       10,     2000,     1),
+  TUN_ENTRY(thresholdK,             1,       20,     1),
+  TUN_ENTRY(minThresholdMargin,     0,     4095,     1),
+  TUN_ENTRY(ropeLength,             1,      500,     1),
+  TUN_ENTRY(ropeSpeedAtFullPower,   1,      100,     1),
+  TUN_ENTRY(ropeCurrentLoss,        0,     0.01,     1),
+  TUN_ENTRY(approachPercent,        0,      100,     1),
+  TUN_ENTRY(approachPower,          0,      255,     1),
+  TUN_ENTRY(holdCurrentTarget,      0,     4095,     1),
+  TUN_ENTRY(holdkP,                 0,       10,     1),
+  TUN_ENTRY(holdkI,                 0,        1,     1),
+  TUN_ENTRY(holdMinPower,           0,      255,     1),
+  TUN_ENTRY(holdMaxPower,           0,      255,     1),
+  TUN_ENTRY(descentLandPower,    -255,        0,     1),
+  TUN_ENTRY(descentAccel,           1,      255,     1),
+  TUN_ENTRY(descentFastTime,        0,    10000,     1),
+  TUN_ENTRY(descentTimeout,       100,    30000,     1),
+  TUN_ENTRY(landedCurrent,          0,     4095,     1),
+  TUN_ENTRY(landedTime,             1,     2000,     1),
+};
+
+const unsigned char TUN_ucNumTunables = sizeof(TUN_Tunables) / sizeof(TUN_Tunable);
+
+static_assert(NVS_TUNABLES_FIRST + sizeof(TUN_Tunables) / sizeof(TUN_Tunable) <= NVS_MAX_KEYS, "not enough NVS keys for the tunables");
+
+//a new value from the web page (core 0) for the control task (core 1)
+struct TUN_Request
+{
+  unsigned char ucIndex;
+  double dValue;
+};
+
+RB_Queue<TUN_Request, 8> TUN_qRequests;
+
+double TUN_Get(const TUN_Tunable *ptTunable)
+{
+  switch (ptTunable->eType)
+  {
+    case TUN_INT:   return (*(int *)ptTunable->pvValue);
+    case TUN_LONG:  return (*(long *)ptTunable->pvValue);
+    case TUN_ULONG: return (*(unsigned long *)ptTunable->pvValue);
+    case TUN_FLOAT: return (*(float *)ptTunable->pvValue);
+    default:        return (*(double *)ptTunable->pvValue);
+  }
+}
+
+static void TUN_Set(TUN_Tunable *ptTunable, double dValue)
+{
+  switch (ptTunable->eType)
+  {
+    case TUN_INT:   *(int *)ptTunable->pvValue = lround(dValue); break;
+    case TUN_LONG:  *(long *)ptTunable->pvValue = lround(dValue); break;
+    case TUN_ULONG: *(unsigned long *)ptTunable->pvValue = lround(dValue); break;
+    case TUN_FLOAT: *(float *)ptTunable->pvValue = dValue; break;
+    default:        *(double *)ptTunable->pvValue = dValue; break;
+  }
+}
+
+static void TUN_Store(unsigned char ucIndex)
+{
+  TUN_Tunable *ptTunable = &TUN_Tunables[ucIndex];
+
+  if ((ptTunable->eType == TUN_FLOAT) || (ptTunable->eType == TUN_DOUBLE))
+  {
+    NVS_StoreDouble(NVS_TUNABLES_FIRST + ucIndex, TUN_Get(ptTunable));
+  }
+  else
+  {
+    NVS_StoreLong(NVS_TUNABLES_FIRST + ucIndex, lround(TUN_Get(ptTunable)));
+  }
+}
+
+static double TUN_Load(unsigned char ucIndex)
+{
+  TUN_Tunable *ptTunable = &TUN_Tunables[ucIndex];
+
+  if ((ptTunable->eType == TUN_FLOAT) || (ptTunable->eType == TUN_DOUBLE))
+  {
+    return (NVS_ReadDouble(NVS_TUNABLES_FIRST + ucIndex));
+  }
+  return (NVS_ReadLong(NVS_TUNABLES_FIRST + ucIndex));
+}
+
+//signature of the list, changes if a tunable is added, removed, moved, retyped or its version is bumped
+static uint32_t TUN_Schema()
+{
+  uint32_t u32Crc = 0;
+
+  for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+  {
+    u32Crc = crc32_le(u32Crc, (const uint8_t *)TUN_Tunables[ucI].strName, strlen(TUN_Tunables[ucI].strName));
+    u32Crc = crc32_le(u32Crc, (const uint8_t *)&TUN_Tunables[ucI].eType, sizeof(TUN_Tunables[ucI].eType));
+    u32Crc = crc32_le(u32Crc, &TUN_Tunables[ucI].ucVersion, sizeof(TUN_Tunables[ucI].ucVersion));
+  }
+  return (u32Crc);
+}
+
+//call once at boot after NVS_Init and before the values are used
+void TUN_Init(boolean btNVSValid)
+{
+  uint32_t u32Schema = TUN_Schema();
+  unsigned char ucLoaded = 0;
+
+  for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+  {
+    TUN_Tunables[ucI].dDefault = TUN_Get(&TUN_Tunables[ucI]);
+  }
+
+  if (btNVSValid && NVS_Exists(NVS_TUNABLES_SCHEMA) && (NVS_ReadULong(NVS_TUNABLES_SCHEMA) == u32Schema))
+  {
+    for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+    {
+      TUN_Tunable *ptTunable = &TUN_Tunables[ucI];
+      double dValue = TUN_Load(ucI);
+
+      if (NVS_Exists(NVS_TUNABLES_FIRST + ucI) && (dValue >= ptTunable->dMin) && (dValue <= ptTunable->dMax))
+      {
+        TUN_Set(ptTunable, dValue);
+        ucLoaded++;
+      }
+    }
+    Serial.printf("Loaded %u of %u tunables\n", ucLoaded, TUN_ucNumTunables);
+  }
+  else
+  {
+    //new or changed list, store the defaults so no value from the old list is loaded into the wrong tunable
+    for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+    {
+      TUN_Store(ucI);
+    }
+    NVS_StoreULong(NVS_TUNABLES_SCHEMA, u32Schema);
+    NVS_RequestCommit();
+    Serial.printf("Tunables list changed, stored %u defaults\n", TUN_ucNumTunables);
+  }
+}
+
+//core 0, queue a new value by name, returns false if there's no such tunable or the value is out of range
+boolean TUN_RequestValue(const char *strName, double dValue)
+{
+  for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+  {
+    if (strcmp(strName, TUN_Tunables[ucI].strName) == 0)
+    {
+      if ((dValue < TUN_Tunables[ucI].dMin) || (dValue > TUN_Tunables[ucI].dMax))
+      {
+        return (false);
+      }
+      TUN_Request tRequest = {ucI, dValue};
+      if (!TUN_qRequests.Push(tRequest))
+      {
+        return (false);
+      }
+      EVT_Post(EVT_COMMAND);   //wake the control task, it may be asleep with the robot stopped
+      return (true);
+    }
+  }
+  return (false);
+}
+
+//core 1 (control task), apply queued values and queue an NVS commit for them, the commit is written in the background
+void TUN_Service()
+{
+  TUN_Request tRequest;
+  boolean btChanged = false;
+
+  while (TUN_qRequests.Pop(tRequest))
+  {
+    TUN_Set(&TUN_Tunables[tRequest.ucIndex], tRequest.dValue);
+    TUN_Store(tRequest.ucIndex);
+    btChanged = true;
+    Serial.printf("Tunable %s = %f\n", TUN_Tunables[tRequest.ucIndex].strName, TUN_Get(&TUN_Tunables[tRequest.ucIndex]));
+  }
+  if (btChanged)
+  {
+    NVS_RequestCommit();
+  }
+}
+
+//"T#^;name;value;min;max;...;END" for the web page
+String TUN_Report()
+{
+  String strReport = "T#^;";
+  char cField[64];
+
+  for (unsigned char ucI = 0; ucI < TUN_ucNumTunables; ucI++)
+  {
+    snprintf(cField, sizeof(cField), "%s;%g;%g;%g;", TUN_Tunables[ucI].strName, TUN_Get(&TUN_Tunables[ucI]),
+             TUN_Tunables[ucI].dMin, TUN_Tunables[ucI].dMax);
+    strReport += cField;
+  }
+  strReport += "END";
+  return (strReport);
+}
+
+#endif
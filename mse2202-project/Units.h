@@ -0,0 +1,61 @@
+#ifndef UNITS_H
+#define UNITS_H 1
+
+/*
+ * Strong types for distances, angles and encoder ticks, so centimeters can't be passed where ticks are expected
+ * Each one is a single int32_t and every operation is constexpr, so they compile to the same integer math as bare ints
+ * (tools/unitsCheck.sh compiles typed and hand written versions on the host and compares their disassembly)
+ * Centimeters and Degrees hold 1/256ths (8 fraction bits) so fractional values like 26.5_cm aren't truncated
+ * Ticks have no fraction bits, their raw value is the tick count
+ * Converting to Ticks multiplies by a ticks per unit ratio in 16.16 fixed point, worked out by the compiler (see "util.h")
+ */
+
+template <typename tag, int fractionBits> struct unit {
+  int32_t raw;    // value * 2^fractionBits
+};
+
+struct centimeterTag {};
+struct degreeTag {};
+struct tickTag {};
+
+typedef unit<centimeterTag, 8> Centimeters;
+typedef unit<degreeTag, 8> Degrees;
+typedef unit<tickTag, 0> Ticks;
+
+constexpr Centimeters operator"" _cm(unsigned long long value) { return {(int32_t)(value << 8)}; }
+constexpr Centimeters operator"" _cm(long double value) { return {(int32_t)(value * 256 + 0.5)}; }
+constexpr Degrees operator"" _deg(unsigned long long value) { return {(int32_t)(value << 8)}; }
+constexpr Degrees operator"" _deg(long double value) { return {(int32_t)(value * 256 + 0.5)}; }
+constexpr Ticks operator"" _ticks(unsigned long long value) { return {(int32_t)value}; }
+
+template <typename tag, int bits> constexpr unit<tag, bits> operator+(unit<tag, bits> a, unit<tag, bits> b) { return {a.raw + b.raw}; }
+template <typename tag, int bits> constexpr unit<tag, bits> operator-(unit<tag, bits> a, unit<tag, bits> b) { return {a.raw - b.raw}; }
+template <typename tag, int bits> constexpr unit<tag, bits> operator-(unit<tag, bits> a) { return {-a.raw}; }
+template <typename tag, int bits> constexpr unit<tag, bits> operator*(unit<tag, bits> a, int32_t scale) { return {a.raw * scale}; }
+template <typename tag, int bits> constexpr unit<tag, bits> operator/(unit<tag, bits> a, int32_t divisor) { return {a.raw / divisor}; }
+
+template <typename tag, int bits> constexpr bool operator==(unit<tag, bits> a, unit<tag, bits> b) { return a.raw == b.raw; }
+template <typename tag, int bits> constexpr bool operator!=(unit<tag, bits> a, unit<tag, bits> b) { return a.raw != b.raw; }
+template <typename tag, int bits> constexpr bool operator<(unit<tag, bits> a, unit<tag, bits> b) { return a.raw < b.raw; }
+template <typename tag, int bits> constexpr bool operator<=(unit<tag, bits> a, unit<tag, bits> b) { return a.raw <= b.raw; }
+template <typename tag, int bits> constexpr bool operator>(unit<tag, bits> a, unit<tag, bits> b) { return a.raw > b.raw; }
+template <typename tag, int bits> constexpr bool operator>=(unit<tag, bits> a, unit<tag, bits> b) { return a.raw >= b.raw; }
+
+// For printing and for code that still works in doubles (calibration), not for the control loop
+template <typename tag, int bits> constexpr double toDouble(unit<tag, bits> a) { return (double)a.raw / (1L << bits); }
+
+// Ticks per unit in 16.16 fixed point
+template <typename tag, int bits> struct tickRatio {
+  int32_t perUnit;
+};
+
+template <typename tag, int bits> constexpr tickRatio<tag, bits> makeTickRatio(double ticksPerUnit) {
+  return {(int32_t)(ticksPerUnit * 65536 + 0.5)};
+}
+
+// Rounded to the nearest tick
+template <typename tag, int bits> constexpr Ticks toTicks(unit<tag, bits> value, tickRatio<tag, bits> ratio) {
+  return {(int32_t)(((int64_t)value.raw * ratio.perUnit + (1LL << (15 + bits))) >> (16 + bits))};
+}
+
+#endif
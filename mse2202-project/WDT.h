@@ -8,6 +8,9 @@
 #ifndef WDT_H
 #define WDT_H 1
 
+#include "RingBuffer.h"
+#include "PostMortem.h"
+
 //---------------------------------------------------------------------------
 //WatchDog
 
@@ -17,10 +20,11 @@
 unsigned char WDT_ucWatchDogCore0BeenSet;
 unsigned char WDT_ucWatchDogCore1BeenSet;
 
-volatile boolean  WDT_vbTiggeredCore0;
-volatile boolean  WDT_vbTiggeredCore1;
-volatile boolean  WDT_vbTiggeredCore0Msg = false;
-volatile boolean  WDT_vbTiggeredCore1Msg = false;
+//time outs are counted by the timer ISR and compared with the count the feed has seen, so neither side needs a lock
+volatile uint32_t WDT_vu32TimeOutsCore0 = 0;   //only written by WDT_TimeOutCore0
+volatile uint32_t WDT_vu32TimeOutsCore1 = 0;
+uint32_t WDT_u32TimeOutsSeenCore0 = 0;         //only written by WDT_ResetCore0
+uint32_t WDT_u32TimeOutsSeenCore1 = 0;
 volatile boolean  WDT_vbCore0Running = false;
 
 volatile unsigned char WDT_ucCaseIndexCore0;
@@ -30,6 +34,22 @@ volatile unsigned char WDT_ucCaseIndexCore1;
 
 volatile uint32_t WDT_vfFastWDTWarningCore0[10];
 volatile uint32_t WDT_vfFastWDTWarningCore1[10];
+volatile uint32_t WDT_vu32OverrunCountCore0[10];   //overruns per case index since boot
+volatile uint32_t WDT_vu32OverrunCountCore1[10];
+const char *WDT_pstrCaseNameCore0[10];             //optional name for each case index, used in the overrun messages
+const char *WDT_pstrCaseNameCore1[10];
+
+//one record per overrun, pushed by the feed and formatted later by WDT_CheckOperationTime on core 0
+struct WDT_OverrunRecord
+{
+  unsigned char ucCore;
+  unsigned char ucCase;
+  uint32_t u32Cycles;   //CPU cycles between the feed before the overrun and the feed after it
+  uint32_t u32Time;     //millis() at the feed after the overrun
+};
+
+RB_Queue<WDT_OverrunRecord, 16> WDT_qOverrunsCore0;   //one queue per core so each has a single producer
+RB_Queue<WDT_OverrunRecord, 16> WDT_qOverrunsCore1;
 
 
 volatile uint32_t WDT_vlPreviousTimeCore0;
@@ -39,39 +59,35 @@ volatile uint32_t WDT_vlNowTimeCore1;
 
 
 hw_timer_t * WDT_htTimer0 = NULL;
-portMUX_TYPE WDT_pmtTimerMux0 = portMUX_INITIALIZER_UNLOCKED;
 hw_timer_t * WDT_htTimer1 = NULL;
-portMUX_TYPE WDT_pmtTimerMux1 = portMUX_INITIALIZER_UNLOCKED;
 
 //---------------------------------------------------------------------------
 
 void IRAM_ATTR WDT_TimeOutCore0() {
-  portENTER_CRITICAL_ISR(&WDT_pmtTimerMux0);
-  //add in timing warning
-  WDT_vbTiggeredCore0 = true;
-  portEXIT_CRITICAL_ISR(&WDT_pmtTimerMux0);
-
+  WDT_vu32TimeOutsCore0 = WDT_vu32TimeOutsCore0 + 1;
 }
 
 void IRAM_ATTR WDT_TimeOutCore1() {
-  portENTER_CRITICAL_ISR(&WDT_pmtTimerMux1);
-  //add in timing warning
-  WDT_vbTiggeredCore1 = true;
-  portEXIT_CRITICAL_ISR(&WDT_pmtTimerMux1);
-
+  WDT_vu32TimeOutsCore1 = WDT_vu32TimeOutsCore1 + 1;
 }
 
 static void WDT_ResetCore0()
 {
-  portENTER_CRITICAL(&WDT_pmtTimerMux0);
+  uint32_t u32TimeOuts = WDT_vu32TimeOutsCore0;
+  WDT_OverrunRecord tRecord;
 
   asm volatile("esync; rsr %0,ccount":"=a" (WDT_vlNowTimeCore0)); // @ 240mHz clock each tick is ~4nS
-  if (WDT_vbTiggeredCore0)
+  if (u32TimeOuts != WDT_u32TimeOutsSeenCore0)
   {
+    WDT_u32TimeOutsSeenCore0 = u32TimeOuts;
     WDT_vfFastWDTWarningCore0[WDT_ucCaseIndexCore0] = WDT_vlNowTimeCore0 - WDT_vlPreviousTimeCore0;
-    WDT_vbTiggeredCore0 = false;
-    WDT_vbTiggeredCore0Msg = true;
-
+    WDT_vu32OverrunCountCore0[WDT_ucCaseIndexCore0] = WDT_vu32OverrunCountCore0[WDT_ucCaseIndexCore0] + 1;
+    tRecord.ucCore = 0;
+    tRecord.ucCase = WDT_ucCaseIndexCore0;
+    tRecord.u32Cycles = WDT_vlNowTimeCore0 - WDT_vlPreviousTimeCore0;
+    tRecord.u32Time = millis();
+    WDT_qOverrunsCore0.Push(tRecord);
+    PM_Overrun(0, tRecord.ucCase, tRecord.u32Cycles);
   }
   else
   {
@@ -79,20 +95,40 @@ static void WDT_ResetCore0()
   }
   WDT_vlPreviousTimeCore0 = WDT_vlNowTimeCore0;
   timerWrite(WDT_htTimer0, 0); //reset timer (feed watchdog)
-  portEXIT_CRITICAL(&WDT_pmtTimerMux0);
+}
+
+//stop the core 1 watchdog while the control task is blocked waiting for an event, sleeping isn't an overrun
+static void WDT_SuspendCore1()
+{
+  timerStop(WDT_htTimer1);
+}
+
+//restart the core 1 watchdog after the control task wakes, any time out from before it stopped is forgotten
+static void WDT_ResumeCore1()
+{
+  timerWrite(WDT_htTimer1, 0);
+  WDT_u32TimeOutsSeenCore1 = WDT_vu32TimeOutsCore1;
+  asm volatile("esync; rsr %0,ccount":"=a" (WDT_vlPreviousTimeCore1)); // @ 240mHz clock each tick is ~4nS
+  timerStart(WDT_htTimer1);
 }
 
 static void WDT_ResetCore1()
 {
-  portENTER_CRITICAL(&WDT_pmtTimerMux1);
+  uint32_t u32TimeOuts = WDT_vu32TimeOutsCore1;
+  WDT_OverrunRecord tRecord;
 
   asm volatile("esync; rsr %0,ccount":"=a" (WDT_vlNowTimeCore1)); // @ 240mHz clock each tick is ~4nS
-  if (WDT_vbTiggeredCore1)
+  if (u32TimeOuts != WDT_u32TimeOutsSeenCore1)
   {
-
+    WDT_u32TimeOutsSeenCore1 = u32TimeOuts;
     WDT_vfFastWDTWarningCore1[WDT_ucCaseIndexCore1] = WDT_vlNowTimeCore1 - WDT_vlPreviousTimeCore1;
-    WDT_vbTiggeredCore1 = false;
-    WDT_vbTiggeredCore1Msg = true;
+    WDT_vu32OverrunCountCore1[WDT_ucCaseIndexCore1] = WDT_vu32OverrunCountCore1[WDT_ucCaseIndexCore1] + 1;
+    tRecord.ucCore = 1;
+    tRecord.ucCase = WDT_ucCaseIndexCore1;
+    tRecord.u32Cycles = WDT_vlNowTimeCore1 - WDT_vlPreviousTimeCore1;
+    tRecord.u32Time = millis();
+    WDT_qOverrunsCore1.Push(tRecord);
+    PM_Overrun(1, tRecord.ucCase, tRecord.u32Cycles);
   }
   else
   {
@@ -100,7 +136,6 @@ static void WDT_ResetCore1()
   }
   WDT_vlPreviousTimeCore1 = WDT_vlNowTimeCore1;
   timerWrite(WDT_htTimer1, 0); //reset timer (feed watchdog)
-  portEXIT_CRITICAL(&WDT_pmtTimerMux1);
 }
 
 void WDT_EnableFastWatchDogCore0()
@@ -146,95 +181,42 @@ void WDT_EnableFastWatchDogCore1()
 }
 
 
+//print one overrun record, integer maths only
+static void WDT_PrintOverrun(const WDT_OverrunRecord &tRecord)
+{
+  uint32_t u32Count = (tRecord.ucCore == 0) ? WDT_vu32OverrunCountCore0[tRecord.ucCase] : WDT_vu32OverrunCountCore1[tRecord.ucCase];
+  const char *strName = (tRecord.ucCore == 0) ? WDT_pstrCaseNameCore0[tRecord.ucCase] : WDT_pstrCaseNameCore1[tRecord.ucCase];
+
+  Serial.printf("WDT core %u case %u %s at %lu mS: %lu.%lu uS between feeds (%lu overruns)\n",
+                tRecord.ucCore, tRecord.ucCase, strName ? strName : "", (unsigned long)tRecord.u32Time,
+                (unsigned long)(tRecord.u32Cycles / 240), (unsigned long)((tRecord.u32Cycles % 240) / 24), (unsigned long)u32Count);
+}
+
+//background consumer, runs in the core 0 watchdog task
+//only a few records are printed per call so a burst of overruns can't turn the watchdog task into one
 void WDT_CheckOperationTime()
 {
-  float fTempCal;
-  unsigned char ucActualCase;
+  static uint32_t u32DroppedReported = 0;
+  WDT_OverrunRecord tRecord;
+  unsigned char ucPrinted = 0;
+  uint32_t u32Dropped;
 
-  if (WDT_vbTiggeredCore0Msg)
+  while ((ucPrinted < 2) && WDT_qOverrunsCore0.Pop(tRecord))
   {
-    WDT_vbTiggeredCore0Msg = false;
-    ucActualCase = WDT_ucCaseIndexCore0 - 1;
-    if (ucActualCase > 10)
-    {
-      ucActualCase = 9;
-    }
-
-    fTempCal = (WDT_vfFastWDTWarningCore0[ucActualCase] * 3) / 1000000;
-    if (fTempCal != 0)
-    {
-      Serial.print("Core 0 Case ");
-      Serial.print(ucActualCase);
-      Serial.print(" its time was = ");
-      Serial.print(fTempCal);
-      Serial.println(" mS  greater than 5ms");
-    }
-    else
-    {
-      fTempCal = (WDT_vfFastWDTWarningCore0[ucActualCase] * 3) / 1000;
-      if (fTempCal != 0)
-      {
-        Serial.print("Core 0 Case ");
-        Serial.print(ucActualCase);
-        Serial.print(" its time was = ");
-        Serial.print(fTempCal);
-        Serial.println(" uS  greater than 5ms");
-      }
-      else
-      {
-        fTempCal = WDT_vfFastWDTWarningCore0[ucActualCase] * 3;
-        if (fTempCal != 0)
-        {
-          Serial.print("Core 0 Case ");
-          Serial.print(ucActualCase);
-          Serial.print(" its time was = ");
-          Serial.print(fTempCal);
-          Serial.println(" nS greater than 5ms");
-        }
-      }
-    }
+    WDT_PrintOverrun(tRecord);
+    ucPrinted++;
   }
-  if (WDT_vbTiggeredCore1Msg)
+  while ((ucPrinted < 4) && WDT_qOverrunsCore1.Pop(tRecord))
+  {
+    WDT_PrintOverrun(tRecord);
+    ucPrinted++;
+  }
+
+  u32Dropped = WDT_qOverrunsCore0.u32Dropped + WDT_qOverrunsCore1.u32Dropped;
+  if (u32Dropped != u32DroppedReported)
   {
-    WDT_vbTiggeredCore1Msg = false;
-    ucActualCase = WDT_ucCaseIndexCore1 - 1;
-    if (ucActualCase > 10)
-    {
-      ucActualCase = 9;
-    }
-    fTempCal = (WDT_vfFastWDTWarningCore1[ucActualCase] * 3) / 1000000;
-    if (fTempCal != 0)
-    {
-      Serial.print("Core 1 Case ");
-      Serial.print(ucActualCase);
-      Serial.print(" its time was = ");
-      Serial.print(fTempCal);
-      Serial.println(" mS greater than 1ms");
-    }
-    else
-    {
-      fTempCal = (WDT_vfFastWDTWarningCore1[ucActualCase] * 3) / 1000;
-      if (fTempCal != 0)
-      {
-        Serial.print("Core 1 Case ");
-        Serial.print(ucActualCase);
-        Serial.print(" its time was = ");
-        Serial.print(fTempCal);
-        Serial.println(" uS greater than 1ms");
-      }
-      else
-      {
-        fTempCal = (WDT_vfFastWDTWarningCore1[ucActualCase] * 3);
-        if (fTempCal != 0)
-        {
-          Serial.print("Core 1 Case ");
-          Serial.print(ucActualCase);
-          Serial.print(" its time was = ");
-          Serial.print(fTempCal);
-          Serial.println(" nS greater than 1ms");
-        }
-      }
-    }
+    Serial.printf("WDT %lu overrun records dropped\n", (unsigned long)(u32Dropped - u32DroppedReported));
+    u32DroppedReported = u32Dropped;
   }
 }
 
@@ -0,0 +1,75 @@
+/*
+  MSE 2202 Team 2
+
+  \Delta coding of watch variable samples
+
+  a sample is the watch variables packed little endian with no padding (see "BreakPoint.h"), WSVR_PackDelta writes one
+  as a delta against the sample before it
+    change mask, varint, bit n set if variable n changed (at most 32 variables)
+    each changed variable in order, the difference (new - old, wrapping at the variable's width, floats by their bit
+    pattern) as a zigzag varint, variables wider than 4 bytes are sent whole instead
+  a varint is 7 bits per byte, least significant first, the top bit set on every byte but the last
+  zigzag maps 0, -1, 1, -2 ... to 0, 1, 2, 3 ... so small differences of either sign are one byte
+  the web page undoes it in getDelta ("BreakPointWEBPage.h"), tools/watchDelta.sh checks the two against each other
+
+  no Arduino or ESP-IDF calls, so the host test builds this file as it is
+*/
+
+#ifndef WATCHDELTA_H
+#define WATCHDELTA_H 1
+
+static uint8_t *WSVR_PackVarint(uint8_t *pucOut, uint32_t u32Value)
+{
+  while (u32Value >= 0x80)
+  {
+    *pucOut++ = (u32Value & 0x7F) | 0x80;
+    u32Value >>= 7;
+  }
+  *pucOut++ = u32Value;
+  return (pucOut);
+}
+
+//one sample as a delta against pucPrevious, pucFieldSizes lists the bytes of each of the uiNumFields variables, returns the end
+static uint8_t *WSVR_PackDelta(uint8_t *pucOut, const uint8_t *pucSample, const uint8_t *pucPrevious, const uint8_t *pucFieldSizes,
+                               size_t uiNumFields)
+{
+  uint32_t u32Mask = 0;
+  size_t uiOffset = 0;
+
+  for (size_t uiField = 0; uiField < uiNumFields; uiField++)
+  {
+    if (memcmp(&pucSample[uiOffset], &pucPrevious[uiOffset], pucFieldSizes[uiField]) != 0)
+    {
+      u32Mask |= 1UL << uiField;
+    }
+    uiOffset += pucFieldSizes[uiField];
+  }
+  pucOut = WSVR_PackVarint(pucOut, u32Mask);
+
+  uiOffset = 0;
+  for (size_t uiField = 0; uiField < uiNumFields; uiField++)
+  {
+    unsigned char ucSize = pucFieldSizes[uiField];
+
+    if ((u32Mask & (1UL << uiField)) && (ucSize > sizeof(uint32_t)))
+    {
+      memcpy(pucOut, &pucSample[uiOffset], ucSize);
+      pucOut += ucSize;
+    }
+    else if (u32Mask & (1UL << uiField))
+    {
+      uint32_t u32New = 0;
+      uint32_t u32Old = 0;
+      unsigned char ucShift = 32 - (ucSize * 8);
+
+      memcpy(&u32New, &pucSample[uiOffset], ucSize);    //little endian, like the frame
+      memcpy(&u32Old, &pucPrevious[uiOffset], ucSize);
+      int32_t i32Delta = (int32_t)((u32New - u32Old) << ucShift) >> ucShift;   //wrapped to the variable's width, sign extended
+      pucOut = WSVR_PackVarint(pucOut, ((uint32_t)i32Delta << 1) ^ (uint32_t)(i32Delta >> 31));
+    }
+    uiOffset += ucSize;
+  }
+  return (pucOut);
+}
+
+#endif
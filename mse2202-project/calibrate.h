@@ -0,0 +1,137 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H 1
+
+#include "drive.h"
+#include "RingBuffer.h"
+#include "TimerWheel.h"
+
+/*
+ * Odometry calibration (see ENC_Calibrate in "Encoder.h")
+ * Started from the web page with "K" while the drive is stopped, then runs two tests and waits for a measurement after each
+ * Straight run: both wheels are driven the same number of ticks for calStraightDistance, then send "K<cm travelled>;<degrees turned clockwise>"
+ * Spin test: the robot spins clockwise in place for calSpinAngle, then send "K<degrees turned>"
+ * The ticks/cm of each wheel and the effective wheelbase are then worked out and stored in NVS
+ * Sending "K" again at any point restarts the calibration
+ */
+
+enum calState {
+  CAL_IDLE = 0,
+  CAL_STRAIGHT,
+  CAL_STRAIGHT_MEASURE,   // Stopped after the straight run, waiting for the distance and heading
+  CAL_SPIN,
+  CAL_SPIN_MEASURE        // Stopped after the spin, waiting for the angle
+};
+
+// Command from the web page (core 0) for the control task, no values to start, otherwise the measurements
+struct calCommand {
+  unsigned char count;
+  double values[2];
+};
+
+RB_Queue<calCommand, 4> calCommands;
+calState curCalState = CAL_IDLE;
+
+int32_t calStraightLeft = 0;    // Ticks counted in the straight run
+int32_t calStraightRight = 0;
+int32_t calSpinLeft = 0;        // Ticks counted in the spin test
+int32_t calSpinRight = 0;
+double calDistance = 0;         // Measured after the straight run
+double calHeading = 0;
+
+TMR_Timer calSettleTimer = TMR_TIMER(NULL);   // Running while the robot rolls to a stop after a run
+
+// Core 0, queue a calibration command from the web page, returns false if the queue is full
+bool requestCalibration(const double *values, unsigned char count) {
+  calCommand command = {count, {0, 0}};
+  for (unsigned char i = 0; i < count && i < 2; i++)
+    command.values[i] = values[i];
+  if (!calCommands.Push(command))
+    return false;
+  EVT_Post(EVT_COMMAND);   // Wake the control task, it sleeps while the robot is stopped
+  return true;
+}
+
+// Whether the calibration needs the loop to run periodically
+bool calibrationActive(void) {
+  return curCalState == CAL_STRAIGHT || curCalState == CAL_SPIN || TMR_IsArmed(&calSettleTimer);
+}
+
+void changeCalState(calState nextState) {
+  curCalState = nextState;
+  drive(0);
+  TMR_Cancel(&calSettleTimer);
+  switch (curCalState) {
+    case CAL_IDLE:
+      Serial.println("Calibration stopped");
+      break;
+    case CAL_STRAIGHT:
+      Serial.println("Calibration straight run");
+      ENC_ClearOdometer();
+      break;
+    case CAL_SPIN:
+      Serial.println("Calibration spin test");
+      ENC_ClearOdometer();
+      break;
+    case CAL_STRAIGHT_MEASURE:    // Keep counting while the robot rolls to a stop
+    case CAL_SPIN_MEASURE:
+      TMR_Arm(&calSettleTimer, calSettleTime * 1000UL);
+      break;
+  }
+}
+
+// Apply a command from the web page
+void calibrationCommand(const calCommand &command) {
+  if (command.count == 0) {
+    if (curDriveState == STOP)
+      changeCalState(CAL_STRAIGHT);
+    else
+      Serial.println("Calibration needs the drive stopped");
+  } else if (curCalState == CAL_STRAIGHT_MEASURE && command.count == 2 && !TMR_IsArmed(&calSettleTimer)) {
+    Serial.printf("Straight run %.1f cm, turned %.1f degrees, ticks left %ld right %ld\n", command.values[0], command.values[1], (long)calStraightLeft, (long)calStraightRight);
+    calDistance = command.values[0];
+    calHeading = command.values[1];
+    changeCalState(CAL_SPIN);
+  } else if (curCalState == CAL_SPIN_MEASURE && command.count == 1 && !TMR_IsArmed(&calSettleTimer)) {
+    Serial.printf("Spin %.1f degrees, ticks left %ld right %ld\n", command.values[0], (long)calSpinLeft, (long)calSpinRight);
+    ENC_Calibrate(calStraightLeft, calStraightRight, calDistance, calHeading, calSpinLeft, calSpinRight, command.values[0]);
+    changeCalState(CAL_IDLE);
+  } else {
+    Serial.println("Calibration isn't waiting for that measurement");
+  }
+}
+
+// Handle the calibration state machine, the drive state machine is stopped while it runs
+void handleCalibration(void) {
+  calCommand command;
+  while (calCommands.Pop(command))
+    calibrationCommand(command);
+
+  switch (curCalState) {
+    case CAL_STRAIGHT: {                                                                  // Equal ticks on both wheels for the nominal distance
+      int steer = (ENC_vi32LeftOdometer - ENC_vi32RightOdometer) * calSteerkP;
+      if ((ENC_vi32LeftOdometer + ENC_vi32RightOdometer) / 2 >= toTicks(calStraightDistance).raw)
+        changeCalState(CAL_STRAIGHT_MEASURE);
+      else
+        drive(calPower - steer, calPower + steer);
+      break;
+    }
+    case CAL_SPIN:                                                                        // Spin clockwise in place for the nominal angle
+      if ((abs(ENC_vi32LeftOdometer) + abs(ENC_vi32RightOdometer)) / 2 >= toTicks(calSpinAngle).raw)
+        changeCalState(CAL_SPIN_MEASURE);
+      else
+        drive(calPower, -calPower);
+      break;
+    case CAL_STRAIGHT_MEASURE:                                                            // Count the ticks once the robot has rolled to a stop
+      calStraightLeft = ENC_vi32LeftOdometer;
+      calStraightRight = ENC_vi32RightOdometer;
+      break;
+    case CAL_SPIN_MEASURE:
+      calSpinLeft = abs(ENC_vi32LeftOdometer);
+      calSpinRight = abs(ENC_vi32RightOdometer);
+      break;
+    case CAL_IDLE:
+      break;
+  }
+}
+
+#endif
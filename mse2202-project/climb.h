@@ -1,15 +1,87 @@
 #ifndef CLIMB_H
 #define CLIMB_H 1
 
-const int holdPower = 40;     // Climb motor power when holding at the top
-const int upPower = 255;      // Climb motor power when ascending
-const int downPower = -255;   // Climb motor power when descending
-const long holdTime = 10000;  // Time to hold before descending
-
-const long currentThreshold = 1750;   // Current sensor threshold that determines whether it's been stalled
-const long currentStallTime = 250;    // How long the current sensor needs to be stalled for it to be "tripped"
-long currentChangeTime = 0;           // How long the current sensor has been stalled for
+#include "NVS.h"
+#include "Events.h"
+#include "TimerWheel.h"
+#include "PostMortem.h"
+#include "Supervisor.h"
+
+// Tuning (the non-const ones can be changed from the web page, see "Tunables.h")
+int holdBasePower = 40;       // Feed-forward climb motor power when holding at the top
+int upPower = 255;            // Climb motor power when ascending
+int downPower = -255;         // Climb motor power when descending
+long holdTime = 10000;        // Time to hold before descending
+
+long currentThreshold = 1750;         // Current sensor threshold that determines whether it's been stalled (recalibrated each climb)
+long currentStallTime = 250;          // How long the current sensor needs to be stalled for it to be "tripped"
 int current = 0;                      // Current sensor reading
+int currentFiltered = 0;              // Low-pass filtered current sensor reading used by the hold loop
+
+// Current Threshold Calibration Constants
+long calibrationSettleTime = 100;         // Time after starting UP to ignore the motor's inrush current for
+long calibrationTime = 300;               // Time to sample the free running current for after settling
+int thresholdK = 6;                       // Number of standard deviations above the baseline to set the stall threshold
+long minThresholdMargin = 150;            // Minimum gap between the baseline and the stall threshold
+
+// Current threshold calibration variables
+long currentBaseline = 0;             // Mean free running current sensor reading, 0 if it has never been calibrated
+long currentNoise = 0;                // Standard deviation of the free running current sensor reading
+long calibrationSamples = 0;          // Number of readings taken in this calibration
+int64_t calibrationSum = 0;           // Sum of the readings taken in this calibration
+int64_t calibrationSumSq = 0;         // Sum of the squares of the readings taken in this calibration
+bool calibrationDirty = false;        // Whether the calibration has changed since it was stored in NVS
+
+// Rope Progress Estimator Constants
+float ropeLength = 60.0;                    // Rope taken in by the winch from the start of the climb to the top (cm)
+float ropeSpeedAtFullPower = 12.0;          // Free running rope speed at 255 climb motor power (cm/s)
+float ropeCurrentLoss = 0.0004;             // Fraction of the rope speed lost per current sensor count above the free running baseline
+int approachPercent = 85;                   // Percent of the climb complete after which the winch slows down for the top
+int approachPower = 150;                    // Climb motor power when approaching the top
+
+// Rope progress estimator variables
+float ropeScale = 1.0;                // Learned correction of the estimate, ropeLength / estimated rope taken in at the top of the last climb
+float ropeTaken = 0;                  // Estimated rope taken in since the start of the climb (cm)
+float ropeSpeed = 0;                  // Estimated rope speed (cm/s)
+int climbPercent = 0;                 // Estimated percent of the climb complete
+long timeToTop = -1;                  // Predicted time until the top is reached, -1 if the winch isn't taking in rope
+unsigned long ropeUpdateTime = 0;     // Last time the estimate was updated
+
+// Hold Tuning Constants
+int holdCurrentTarget = 1400;         // Current sensor reading that corresponds to the desired holding torque (below currentThreshold)
+double holdkP = 0.05;                 // Constant of proportionality for the hold current loop
+double holdkI = 0.002;                // Constant of integration for the hold current loop
+int holdMinPower = 20;                // Minimum climb motor power while holding so the robot never free falls
+int holdMaxPower = 160;               // Maximum climb motor power while holding
+const int currentFilterShift = 3;     // Current filter weight, each new sample contributes 1 / 2^currentFilterShift
+
+// Hold measuring variables
+int holdError = 0;                    // Difference between holdCurrentTarget and the filtered current
+double holdIntegral = 0;              // Integral portion of the hold PI loop
+int holdPower = 0;                    // Climb motor power output by the hold PI loop
+
+// Descent Tuning Constants
+int descentLandPower = -60;           // Climb motor power for the last part of the descent so the robot lands softly
+int descentAccel = 2;                 // Maximum change in climb motor power per millisecond while descending
+long descentFastTime = 1500;          // Time to descend at downPower before slowing to descentLandPower
+long descentTimeout = 4000;           // Time after which the descent is finished regardless of the current sensor
+int landedCurrent = 600;              // Filtered current sensor reading below which the rope is slack (robot has landed)
+long landedTime = 100;                // How long the current needs to be below landedCurrent for the robot to be landed
+
+// Descent measuring variables
+int descentPower = 0;                 // Climb motor power output by the descent profile
+unsigned long descentUpdateTime = 0;  // Last time the descent profile was updated
+
+// Limit switch constants and variables
+// The limit switch is debounced by a one-shot hardware timer (timers 0 and 1 are used by the watchdogs in "WDT.h")
+// The timer functions aren't in IRAM, so the edge ISR only posts an event and the control task restarts the timer
+const int limitSwitchTimer = 2;                   // Hardware timer used to debounce the limit switch
+const uint64_t limitSwitchDebounceTime = 300;     // Microseconds the limit switch needs to be settled closed for before it's "tripped"
+hw_timer_t * limitSwitchDebounceTimer = NULL;
+volatile bool limitSwitchDebouncing = false;      // Whether the debounce timer is running
+volatile bool limitSwitchTripped = false;         // Top reached event from the limit switch, consumed by the climb state machine
+volatile uint32_t limitSwitchContactTime = 0;     // CPU cycle count at the first edge of the limit switch contact
+uint32_t limitSwitchLatency = 0;                  // CPU cycles from the limit switch contact to the climb entering HOLD
 
 // Climb states for state machine
 enum climbState {
@@ -23,9 +95,145 @@ enum climbState {
 unsigned long climbStateTime = 0;
 climbState curClimbState = STOPPED;
 
+// Limit switch edge interrupt, safe to run while the flash cache is off (NVS commits), so it only touches IRAM code
+void IRAM_ATTR limitSwitchISR() {
+  if (!limitSwitchDebouncing) {
+    asm volatile("esync; rsr %0,ccount":"=a" (limitSwitchContactTime)); // @ 240mHz clock each tick is ~4nS
+    limitSwitchDebouncing = true;
+  }
+  EVT_PostFromISR(EVT_LIMIT_SWITCH_EDGE);
+}
+
+// Control task, (re)start the debounce timer after every edge so it only expires once the switch settles
+void restartLimitSwitchDebounce(void) {
+  timerWrite(limitSwitchDebounceTimer, 0);
+  timerAlarmEnable(limitSwitchDebounceTimer);
+}
+
+// Limit switch debounce timer interrupt, posts the top reached event if the switch is still closed
+void IRAM_ATTR limitSwitchDebounceISR() {
+  if (digitalRead(ciLimitSwitch) == LOW) {
+    limitSwitchTripped = true;
+    EVT_PostFromISR(EVT_LIMIT_SWITCH);
+  }
+  limitSwitchDebouncing = false;
+}
+
+// Set the stall threshold k standard deviations above the free running baseline
+void setCurrentThreshold(void) {
+  currentThreshold = currentBaseline + max((long)thresholdK * currentNoise, minThresholdMargin);
+}
+
+// Load the last climb's calibration from NVS, keep the defaults for any value that isn't stored
+void loadClimbCalibration(bool nvsValid) {
+  if (!nvsValid)
+    return;
+
+  long baseline = NVS_ReadLong(NVS_CLIMB_BASELINE);
+  long noise = NVS_ReadLong(NVS_CLIMB_NOISE);
+  if (baseline > 0 && baseline < 4095 && noise >= 0) {
+    currentBaseline = baseline;
+    currentNoise = noise;
+    setCurrentThreshold();
+    Serial.printf("Loaded climb current baseline %ld, noise %ld, threshold %ld\n", currentBaseline, currentNoise, currentThreshold);
+  }
+
+  long scale = NVS_ReadLong(NVS_CLIMB_ROPE_SCALE);
+  if (scale >= 500 && scale <= 2000) {
+    ropeScale = scale / 1000.0;
+    Serial.printf("Loaded climb rope scale %ld/1000\n", scale);
+  }
+}
+
+// Store the current calibration in NVS, the commit is written in the background so this doesn't stall the climb
+void storeClimbCalibration(void) {
+  if (!calibrationDirty)
+    return;
+
+  NVS_StoreLong(NVS_CLIMB_BASELINE, currentBaseline);
+  NVS_StoreLong(NVS_CLIMB_NOISE, currentNoise);
+  NVS_StoreLong(NVS_CLIMB_ROPE_SCALE, ropeScale * 1000);
+  NVS_RequestCommit();
+  calibrationDirty = false;
+}
+
+/*
+ * Learn the free running climb current at the start of UP
+ * Readings are ignored for calibrationSettleTime while the motor's inrush current dies down, then sampled for calibrationTime
+ * The stall threshold is then set from the mean and standard deviation of the samples
+ * Returns true while the calibration is still running so the stall detector can ignore the current until then
+ */
+bool calibrateCurrent(void) {
+  unsigned long elapsed = millis() - climbStateTime;
+
+  if (elapsed < calibrationSettleTime)
+    return true;
+
+  if (elapsed < calibrationSettleTime + calibrationTime) {
+    calibrationSamples++;
+    calibrationSum += current;
+    calibrationSumSq += (int64_t)current * current;
+    return true;
+  }
+
+  if (calibrationSamples > 1) {
+    int64_t n = calibrationSamples;
+    int64_t variance = (n * calibrationSumSq - calibrationSum * calibrationSum) / (n * (n - 1));
+    currentBaseline = calibrationSum / n;
+    currentNoise = sqrt(max((int64_t)0, variance));
+    setCurrentThreshold();
+    calibrationDirty = true;
+    calibrationSamples = 0;
+    Serial.printf("Calibrated climb current baseline %ld, noise %ld, threshold %ld\n", currentBaseline, currentNoise, currentThreshold);
+    storeClimbCalibration();
+  }
+
+  return false;
+}
+
+/*
+ * Estimate the rope taken in by integrating the winch speed over time
+ * The rope speed is the free running speed scaled by the motor power, reduced by the load seen in the current above the free running baseline
+ * Also updates the percent of the climb complete and the predicted time until the top
+ */
+void estimateRope(int power) {
+  unsigned long now = millis();
+  long load = currentBaseline > 0 ? max(0L, (long)currentFiltered - currentBaseline) : 0;
+
+  ropeSpeed = ropeScale * ropeSpeedAtFullPower * power / 255 * max(0.0f, 1 - ropeCurrentLoss * load);
+  ropeTaken += ropeSpeed * (now - ropeUpdateTime) / 1000;
+  ropeUpdateTime = now;
+
+  climbPercent = min(100, (int)(100 * ropeTaken / ropeLength));
+  timeToTop = ropeSpeed > 0 ? max(0.0f, ropeLength - ropeTaken) * 1000 / ropeSpeed : -1;
+}
+
+// Correct the estimator scale at the top of the climb, where the rope taken in is known to be ropeLength
+void learnRopeScale(void) {
+  if (ropeTaken < ropeLength / 4)   // Ignore climbs that were too short to be the full rope
+    return;
+
+  ropeScale = constrain(ropeScale * ropeLength / ropeTaken, 0.5f, 2.0f);
+  calibrationDirty = true;
+  Serial.printf("Top reached at %d%% estimated, rope scale now %.3f\n", climbPercent, ropeScale);
+}
+
+// Climb motor power when ascending, slow down for the top once the estimate is close to it
+int climbUpPower(void) {
+  return climbPercent >= approachPercent ? approachPower : upPower;
+}
+
 // Setup sensors, motors, and LEDC channels for climbing
-void setupClimb(void) {
+void setupClimb(bool nvsValid) {
   pinMode(ciCurrentSensor, INPUT); // Current sensor
+  pinMode(ciLimitSwitch, INPUT_PULLUP); // Limit switch at the top of the rope, closes to ground
+
+  limitSwitchDebounceTimer = timerBegin(limitSwitchTimer, 80, true); // 1uS ticks
+  timerAttachInterrupt(limitSwitchDebounceTimer, &limitSwitchDebounceISR, true);
+  timerAlarmWrite(limitSwitchDebounceTimer, limitSwitchDebounceTime, false); // one shot
+  attachInterrupt(ciLimitSwitch, limitSwitchISR, FALLING);
+
+  loadClimbCalibration(nvsValid);
 
   ledcAttachPin(ciMotorClimbA, 5); // assign Motors pins to channels
   ledcAttachPin(ciMotorClimbB, 6);
@@ -36,6 +244,9 @@ void setupClimb(void) {
 
 // Power the climb motor between -255 to 255
 void climb(int power) {
+  if (SUP_MotorsCut()) {   // The supervisor cut the motors, leave them off until loop() has stopped the state machines
+    return;
+  }
   if (power > 0) {
     ledcWrite(5, min(255, abs(power)));
     ledcWrite(6, 0);
@@ -48,10 +259,63 @@ void climb(int power) {
   }
 }
 
+void changeClimbState(climbState nextState);
+
+// The current has stayed above currentThreshold for currentStallTime, the robot has reached the top
+void stallDone(void) {
+  changeClimbState(HOLD);
+}
+
+// Held for holdTime, start going back down
+void holdDone(void) {
+  changeClimbState(DOWN);
+}
+
+// Landed, or descentTimeout ran out before the current sensor saw the landing
+void descentDone(void) {
+  changeClimbState(STOPPED);
+}
+
+// Climb state timeouts, armed by changeClimbState and handleClimb, all cancelled on every state change
+TMR_Timer stallTimer = TMR_TIMER(stallDone);              // Running while the current is above currentThreshold in UP
+TMR_Timer holdTimer = TMR_TIMER(holdDone);                // Ends HOLD after holdTime
+TMR_Timer descentFastTimer = TMR_TIMER(NULL);             // Running while descending at downPower
+TMR_Timer descentTimeoutTimer = TMR_TIMER(descentDone);   // Ends DOWN after descentTimeout
+TMR_Timer landedTimer = TMR_TIMER(descentDone);           // Running while the current is below landedCurrent after the fast part of the descent
+
 // Change and log the climb state to the given climbState
 void changeClimbState(climbState nextState) {
   curClimbState = nextState;
 
+  TMR_Cancel(&stallTimer);
+  TMR_Cancel(&holdTimer);
+  TMR_Cancel(&descentFastTimer);
+  TMR_Cancel(&descentTimeoutTimer);
+  TMR_Cancel(&landedTimer);
+
+  if (curClimbState == HOLD) {          // Correct the rope estimate and start the hold loop from the feed-forward power
+    learnRopeScale();
+    holdError = 0;
+    holdIntegral = 0;
+    holdPower = holdBasePower;
+    TMR_Arm(&holdTimer, holdTime * 1000UL);
+  } else if (curClimbState == UP) {     // Forget any limit switch contact from before the climb and start a new current calibration
+    limitSwitchTripped = false;
+    calibrationSamples = 0;
+    calibrationSum = 0;
+    calibrationSumSq = 0;
+    ropeTaken = 0;
+    climbPercent = 0;
+    ropeUpdateTime = millis();
+  } else if (curClimbState == STOPPED) {  // Store the new rope scale
+    storeClimbCalibration();
+  } else if (curClimbState == DOWN) {   // Start the descent from the last hold power so the robot doesn't drop
+    descentPower = holdPower;
+    descentUpdateTime = millis();
+    TMR_Arm(&descentFastTimer, descentFastTime * 1000UL);
+    TMR_Arm(&descentTimeoutTimer, descentTimeout * 1000UL);
+  }
+
   switch (curClimbState) {
     case STOPPED:
       Serial.printf("Switched state to STOPPED, took %lu time\n", millis() - climbStateTime);
@@ -64,10 +328,15 @@ void changeClimbState(climbState nextState) {
       break;
     case HOLD:
       Serial.printf("Switched state to HOLD, took %lu time\n", millis() - climbStateTime);
+      if (limitSwitchTripped)
+        Serial.printf("Top reached by limit switch, contact to HOLD took %lu uS\n", (unsigned long)(limitSwitchLatency / 240));
+      else
+        Serial.printf("Top reached by current stall\n");
       break;
   }
 
   climbStateTime = millis();
+  PM_ClimbState(curClimbState);
 }
 
 // Stop the climb by changing the climb state to STOPPED
@@ -80,32 +349,86 @@ void startClimb(void) {
   changeClimbState(UP);
 }
 
+/*
+ * Current regulated PI loop that holds the robot at the top of the rope
+ * The climb current is proportional to the winch torque, so regulating it to holdCurrentTarget holds a constant torque regardless of load
+ * The loop starts from holdBasePower and the integral makes up the difference for heavier or lighter loads
+ * The integral is clamped to the output range so it doesn't wind up while the power is saturated
+ */
+int holdCurrentPI(void) {
+  holdError = holdCurrentTarget - currentFiltered;
+  holdIntegral += holdError * holdkI;
+  holdIntegral = constrain(holdIntegral, holdMinPower - holdBasePower, holdMaxPower - holdBasePower);
+
+  holdPower = holdBasePower + holdError * holdkP + holdIntegral;
+  holdPower = constrain(holdPower, holdMinPower, holdMaxPower);
+  return holdPower;
+}
+
+/*
+ * Motion profile for lowering the robot back down the rope
+ * The target power is downPower for descentFastTime, then descentLandPower for the rest of the descent
+ * The output power slews toward the target at no more than descentAccel per millisecond, so the winch never jerks the rope
+ * The robot has landed once the filtered current has stayed below landedCurrent for landedTime, landedTimer then stops the climb
+ */
+void descend(void) {
+  unsigned long now = millis();
+  bool fast = TMR_IsArmed(&descentFastTimer);
+  int targetPower = fast ? downPower : descentLandPower;
+  int maxStep = descentAccel * (now - descentUpdateTime);
+  descentUpdateTime = now;
+
+  descentPower += constrain(targetPower - descentPower, -maxStep, maxStep);
+  climb(descentPower);
+
+  if (fast || currentFiltered >= landedCurrent) {    // The current is only a landing signature once the robot has slowed down
+    TMR_Cancel(&landedTimer);
+  } else if (!TMR_IsArmed(&landedTimer)) {
+    TMR_Arm(&landedTimer, landedTime * 1000UL);
+  }
+}
+
+// Whether the climb state machine needs to run periodically
+bool climbActive(void) {
+  return curClimbState != STOPPED;
+}
+
 // Handle the climb state machine based on the current climb state
 void handleClimb(void) {
   current = analogRead(ciCurrentSensor);
+  currentFiltered += (current - currentFiltered) >> currentFilterShift;
 
-  if (current <= currentThreshold) {                                      // If the current is underneath the current stall threshold
-    currentChangeTime = 0;                                                // set the time the current has stalled for to 0
-  } else if (currentChangeTime != 0 && millis() > currentChangeTime) {    // Else if the current has been stalling for more than currentChangeTime (tripped)
-    changeClimbState(HOLD);                                               // change the climb state to HOLD 
-  } else if (currentChangeTime == 0 && current > currentThreshold) {      // Else if the current sensor just started stalling
-    currentChangeTime = millis() + currentStallTime;                      // Set the current stall timeout to currentStallTime milliseconds from now
-  } 
+  if (curClimbState == UP) {                                              // Only look for the top while ascending
+                                                                          // (changeClimbState has already cancelled stallTimer)
+    if (limitSwitchTripped) {                                             // If the limit switch has posted a top reached event
+      uint32_t now;
+      asm volatile("esync; rsr %0,ccount":"=a" (now)); // @ 240mHz clock each tick is ~4nS
+      limitSwitchLatency = now - limitSwitchContactTime;
+      changeClimbState(HOLD);                                             // change the climb state to HOLD
+    } else if (calibrateCurrent()) {                                      // Else if the free running current is still being calibrated
+      TMR_Cancel(&stallTimer);                                            // don't look for a stall yet
+    } else if (current <= currentThreshold) {                             // If the current is underneath the current stall threshold
+      TMR_Cancel(&stallTimer);                                            // stop timing the stall
+    } else if (!TMR_IsArmed(&stallTimer)) {                               // Else if the current sensor just started stalling
+      TMR_Arm(&stallTimer, currentStallTime * 1000UL);                    // stallDone changes to HOLD if it's still stalled currentStallTime milliseconds from now
+    }
+  }
 
   switch (curClimbState) {
     case STOPPED:                                   // STOPPED: set the climb motor to 0 power
       climb(0);
       break;
-    case UP:                                        // UP: set the climb motor to the ascent power
-      climb(upPower);
+    case UP: {                                      // UP: set the climb motor to the ascent power and track the rope taken in
+      int power = climbUpPower();
+      climb(power);
+      estimateRope(power);
       break;
-    case DOWN:                                      // DOWN: set the climb motor to the descent power
-      climb(-downPower);
+    }
+    case DOWN:                                      // DOWN: lower the robot along the descent profile, descentDone stops it once it has landed
+      descend();
       break;
-    case HOLD:                                      // HOLD: set the climb motor to the hold power, start descending after holdTime amount of time after entering the state
-      climb(holdPower);
-      if (millis() > climbStateTime + holdTime)
-        changeClimbState(DOWN);
+    case HOLD:                                      // HOLD: regulate the climb motor current to the holding torque, holdDone starts descending after holdTime
+      climb(holdCurrentPI());
       break;
   }
 }
@@ -3,6 +3,10 @@
 
 #include "util.h"
 #include "tuning.h"
+#include "route.h"
+#include "TimerWheel.h"
+#include "PostMortem.h"
+#include "Supervisor.h"
 
 // Global movement measuring variables
 // These are context dependent and not local to easily graph in the web server
@@ -16,16 +20,41 @@ int power2 = 0;
 
 int proportional1 = 0;      // Proportional portion of PI loop
 int proportional2 = 0;
-double integral = 0;        // Integral portion of PI loop
+int32_t integral = 0;       // Integral portion of PI loop (16.16 fixed point)
+
+// PI gains and ramp of the current maneuver, taken from the tunables in "tuning.h" when it starts
+// so the control loop only does integer math (16.16 fixed point gains, the ramp is a plain copy and stays a runtime tunable)
+int32_t gainP = 0;
+int32_t gainI = 0;
+int32_t gainSteer = 0;
+int accelTime = 0;          // Milliseconds to ramp from 0 to driveMaxPower
+const int32_t brakeRatioMax = 4L << 16;   // Most the side further ahead is braked by in BRAKE, times brakePower (16.16 fixed point)
+Ticks maneuverTicks = 0_ticks;   // Calibrated encoder target of the current maneuver (see "route.h")
 
 // Maneuver management variables
-const int nDriveManeuvers = sizeof(driveManeuvers) / sizeof(driveManeuver);     // Number of drive maneuvers declared in "tuning.h"
 unsigned int driveManeuverIndex = 0;
 
 // Drive state management variables
 unsigned long driveStateTime = 0;
 driveState curDriveState = STOP;
 
+void changeState(driveState nextState);
+
+// Once the brake timer runs out, go to the next maneuver if there is one or stop the drive
+void brakeDone(void) {
+  if (driveManeuverIndex < nDriveManeuvers - 1) {
+    driveManeuverIndex++;
+    changeState(driveManeuvers[driveManeuverIndex].state);
+  } else {
+    changeState(STOP);
+  }
+}
+
+// Drive state timeouts, armed by changeState
+TMR_Timer driveAccelTimer = TMR_TIMER(NULL);        // Running while the motors ramp up at the start of a DRIVE or TURN
+TMR_Timer driveBrakeTimer = TMR_TIMER(brakeDone);   // Ends BRAKE after brakeTime
+TMR_Timer drivePrintTimer = TMR_TIMER(NULL);        // Running for printTime after every state change
+
 // Reset global measuring variables
 void resetMeasurements(void) {
   ENC_ClearOdometer();
@@ -55,12 +84,15 @@ void setupDrive() {
 
 // Power the left drive motor between -255 to 255
 void driveLeftSide(int power) {
+  if (SUP_MotorsCut()) {   // The supervisor cut the motors, leave them off until loop() has stopped the state machines
+    return;
+  }
   if (power > 0) {
     ledcWrite(1, min(power, abs(driveMaxPower)));
     ledcWrite(2, 0);
   } else if (power < 0) {
     ledcWrite(1, 0);
-    ledcWrite(2, min(power, abs(driveMaxPower)));
+    ledcWrite(2, min(-power, abs(driveMaxPower)));
   } else {
     ledcWrite(1, 0);
     ledcWrite(2, 0);
@@ -69,12 +101,15 @@ void driveLeftSide(int power) {
 
 // Power the right drive motor between -255 to 255
 void driveRightSide(int power) {
+  if (SUP_MotorsCut()) {
+    return;
+  }
   if (power > 0) {
     ledcWrite(3, min(power, abs(driveMaxPower)));
     ledcWrite(4, 0);
   } else if (power < 0) {
     ledcWrite(3, 0);
-    ledcWrite(4, min(power, abs(driveMaxPower)));
+    ledcWrite(4, min(-power, abs(driveMaxPower)));
   } else {
     ledcWrite(3, 0);
     ledcWrite(4, 0);
@@ -97,32 +132,32 @@ void drive(int leftPower, int rightPower) {
  * Algorithm to drive the robot straight to a given centimeters target relative to its current position
  * The power is controlled by a proportional integral (PI) loop, with tuning parameters found in "tuning.h"
  * Local error and power variables are created to make them more contextual, but are set up as a reference to the global measurement variables
- * error1 is determined by difference between the target (centimeters to encoder ticks) and the average of the left/right encoder
+ * error1 is determined by difference between the target (encoder ticks) and the average of the left/right encoder
  * error2 is determined by the difference between left and right encoders, this value is used to adjust the left/right motor speeds proportionally
  */
-bool driveTo(int cmTarget) {
-  target = cmToEnc(cmTarget);
+bool driveTo(Ticks ticks) {
+  target = ticks.raw;
   int& distError = error1;
   int& steerError = error2;
 
   distError = target - (ENC_vi32LeftOdometer + ENC_vi32RightOdometer) / 2;
-  steerError = ENC_vi32LeftOdometer - ENC_vi32RightOdometer;
+  steerError = ENC_vi32LeftOdometer - rightEncAsLeft(ENC_vi32RightOdometer);
 
   int& power = power1;
   int& steerPower = power2;
   int& distP = proportional1;
   int& steerP = proportional2;
-  double& distIntegral = integral;
+  int32_t& distIntegral = integral;
 
-  if (millis() < driveStateTime + driveAccelTime) {
+  if (TMR_IsArmed(&driveAccelTimer)) {
     distP = 0;
-    power = map(millis() - driveStateTime, 0, driveAccelTime, 0, driveMaxPower);
+    power = map(millis() - driveStateTime, 0, accelTime, 0, driveMaxPower);
   } else {
-    distP = distError * drivekP;
-    power = distP + distIntegral;
+    distP = fixedMul(distError, gainP);
+    power = distP + (distIntegral >> 16);
   }
 
-  steerP = steerError * driveSteerkP;
+  steerP = fixedMul(steerError, gainSteer);
   steerPower = steerP;
 
   int leftPower = max(0, power + steerPower);
@@ -133,7 +168,7 @@ bool driveTo(int cmTarget) {
   else
     return true;
 
-  distIntegral += drivekI;
+  distIntegral += gainI;
   return false;
 }
 
@@ -141,11 +176,11 @@ bool driveTo(int cmTarget) {
  * Algorithm to tank turn the robot to a given angle relative to its current position
  * The power is controlled by a proportional integral (PI) loop, with tuning parameters found in "tuning.h"
  * Local error and power variables are created to make them more contextual, but are set up as a reference to the global measurement variables
- * error1 is determined by difference between the target (angle converted to encoder ticks) and the average of the absolute values of the left/right encoder
+ * error1 is determined by difference between the target (encoder ticks) and the average of the absolute values of the left/right encoder
  * error2 is determined by the difference between left and right encoders, this value isn't used to power the motors
  */
-bool turnTo(int degTarget, bool cw) {
-  target = degTurnToEnc(degTarget);
+bool turnTo(Ticks ticks, bool cw) {
+  target = ticks.raw;
 
   int& distEerror = error1;
   int& wheelError = error2;
@@ -157,17 +192,17 @@ bool turnTo(int degTarget, bool cw) {
   int& rightPower = power2;
   int& p = proportional1;
   proportional2 = 0;
-  double& turnIntegral = integral;
+  int32_t& turnIntegral = integral;
   int i = cwNavigation ? -1 : 1;
   
-  if (millis() < driveStateTime + driveAccelTime) {
+  if (TMR_IsArmed(&driveAccelTimer)) {
     p = 0;
-    leftPower = map(millis() - driveStateTime, 0, driveAccelTime, 0, driveMaxPower) * i;
-    rightPower = map(millis() - driveStateTime, 0, driveAccelTime, 0, driveMaxPower) * -i;
+    leftPower = map(millis() - driveStateTime, 0, accelTime, 0, driveMaxPower) * i;
+    rightPower = map(millis() - driveStateTime, 0, accelTime, 0, driveMaxPower) * -i;
   } else {
-    p = distEerror * turnkP;
-    leftPower = (p + turnIntegral) * i;
-    rightPower = (p + turnIntegral) * -i;
+    p = fixedMul(distEerror, gainP);
+    leftPower = (p + (turnIntegral >> 16)) * i;
+    rightPower = (p + (turnIntegral >> 16)) * -i;
   }
 
   if (distEerror >= 2)
@@ -175,14 +210,31 @@ bool turnTo(int degTarget, bool cw) {
   else
     return true;
 
-  turnIntegral += turnkI;
+  turnIntegral += gainI;
   return false;
 }
 
+// How much harder to brake a side that has gone ticks while the other side went otherTicks, (ticks / otherTicks)^2 as 16.16
+// fixed point, at most brakeRatioMax, and brakeRatioMax if only this side moved
+int32_t brakeRatio(int32_t ticks, int32_t otherTicks) {
+  uint32_t ahead = abs(ticks);
+  uint32_t behind = abs(otherTicks);
+  if (behind == 0)
+    return ahead == 0 ? 65536 : brakeRatioMax;
+  uint64_t ratio = ((uint64_t)ahead << 16) / behind;
+  if (ratio >= brakeRatioMax)   // Squared it would be past the limit anyway, and can't overflow below it
+    return brakeRatioMax;
+  return min((int32_t)((ratio * ratio) >> 16), brakeRatioMax);
+}
+
 // Change and log the drive state to the given driveState
 void changeState(driveState nextState) {
   curDriveState = nextState;
 
+  TMR_Cancel(&driveAccelTimer);
+  TMR_Cancel(&driveBrakeTimer);
+  TMR_Arm(&drivePrintTimer, printTime * 1000UL);
+
   switch (curDriveState) {
     case STOP:
       Serial.printf("Switched state to STOP, took %lu time\n", millis() - driveStateTime);
@@ -191,17 +243,33 @@ void changeState(driveState nextState) {
     case DRIVE:
       Serial.printf("Switched state to DRIVE, took %lu time\n", millis() - driveStateTime);
       resetMeasurements();
+      updateOdometryScales();
+      maneuverTicks = routeTarget(driveManeuverIndex);
+      gainP = toFixed(drivekP);
+      gainI = toFixed(drivekI);
+      gainSteer = toFixed(driveSteerkP);
+      accelTime = driveAccelTime;
+      TMR_Arm(&driveAccelTimer, driveAccelTime * 1000UL);
       break;
     case TURN:
       Serial.printf("Switched state to TURN, took %lu time\n", millis() - driveStateTime);
       resetMeasurements();
+      updateOdometryScales();
+      maneuverTicks = routeTarget(driveManeuverIndex);
+      gainP = toFixed(turnkP);
+      gainI = toFixed(turnkI);
+      gainSteer = 0;
+      accelTime = turnAccelTime;
+      TMR_Arm(&driveAccelTimer, turnAccelTime * 1000UL);
       break;
     case BRAKE:
       Serial.printf("Switched state to BRAKE, took %lu time\n", millis() - driveStateTime);
+      TMR_Arm(&driveBrakeTimer, brakeTime * 1000UL);
       break;
   }
 
   driveStateTime = millis();
+  PM_DriveState(curDriveState, driveManeuverIndex);
 }
 
 // Start the drive if it's stopped, stop the drive if it's running
@@ -215,16 +283,19 @@ void toggleDrive() {
 
 // Returns whether the robot is on its last drive maneuver and ready to climb
 bool readyToClimb(void) {
-  if (driveManeuverIndex == nDriveManeuvers - 1)
-    return true;
+  return driveManeuverIndex == nDriveManeuvers - 1;
 }
 
-// Handle the drive state machine based on the current drive state
-void handleDrive(void) {
+// Whether the drive state machine needs to run periodically (moving, or printing the measurements after a movement)
+bool driveActive(void) {
+  return curDriveState != STOP || TMR_IsArmed(&drivePrintTimer);
+}
+
+// Print the measurement variables whether in a movement or for a short (printTime) period after exiting a movement
+void printDriveMeasurements(void) {
   bool inMotionAlg = curDriveState == DRIVE || curDriveState == TURN;   // Whether the robot is currently driving or turning
-  bool printing =  millis() < driveStateTime + printTime;               // Whether to print the measurement variables after finishing a movement
+  bool printing = TMR_IsArmed(&drivePrintTimer);                        // Whether to print the measurement variables after finishing a movement
 
-  // Print measurement variables whether in a movement or for a short (printTime) period after exiting a movement
   if (inMotionAlg || printing) {
     if (inMotionAlg) {
       Serial.printf("IN ALG.   | ");
@@ -233,33 +304,36 @@ void handleDrive(void) {
       error2 = abs(ENC_vi32LeftOdometer) - abs(ENC_vi32RightOdometer);                    // Difference between left/right encoders
       Serial.printf("DONE ALG. | ");
     }
-    Serial.printf("T: %d, E1: %3d, E2: %3d, P1: %3d, P2: %3d, p1: %3d, p2: %3d, i: %f\n", target, error1, error2, power1, power2, proportional1, proportional2, integral);
+    Serial.printf("T: %d, E1: %3d, E2: %3d, P1: %3d, P2: %3d, p1: %3d, p2: %3d, i: %ld\n", target, error1, error2, power1, power2, proportional1, proportional2, (long)(integral >> 16));
   }
+}
 
-
+// Handle the drive state machine based on the current drive state
+void handleDrive(void) {
   switch (curDriveState) {
     case STOP:                                                                              // STOP: set the drive powers to 0
       power1 = 0;
       power2 = 0;
       drive(power1);
       break;
-    case DRIVE:                                                                             // DRIVE: drive straight to the next maneuver's target centimeters
-      if (driveTo(driveManeuvers[driveManeuverIndex].target))
+    case DRIVE:                                                                             // DRIVE: drive straight to the maneuver's target ticks
+      if (driveTo(maneuverTicks))
         changeState(BRAKE);
       break;
-    case TURN:                                                                              // TURN: turn to the next maneuver's target angle
-      if (turnTo(driveManeuvers[driveManeuverIndex].target, cwNavigation))
+    case TURN:                                                                              // TURN: turn to the maneuver's target ticks
+      if (turnTo(maneuverTicks, cwNavigation))
         changeState(BRAKE);
       break;
     case BRAKE:                                                                             // BRAKE: brake the motors based on the last maneuver (drive or turn)
       driveState state = driveManeuvers[driveManeuverIndex].state;
-      int target = driveManeuvers[driveManeuverIndex].target;
 
       if (state == DRIVE) {
         // If one encoder is further ahead than another, brake the one further ahead by more
-        int power = -brakePower * sgn(target);
-        power1 = power * pow((double)ENC_vi32LeftOdometer / ENC_vi32RightOdometer, 2.2);
-        power2 = power * pow((double)ENC_vi32RightOdometer / ENC_vi32LeftOdometer, 2.2);
+        int power = -brakePower * sgn(driveManeuvers[driveManeuverIndex].distance.raw);
+        int32_t leftTicks = ENC_vi32LeftOdometer;
+        int32_t rightTicks = ENC_vi32RightOdometer;
+        power1 = fixedMul(power, brakeRatio(leftTicks, rightTicks));
+        power2 = fixedMul(power, brakeRatio(rightTicks, leftTicks));
         drive(power1, power2);
       } else if (state == TURN) {
         // Brake the left and right sides opposite of the direction they were moving in the turn
@@ -268,16 +342,7 @@ void handleDrive(void) {
         power2 = brakePower * i;
         drive(power1, power2);
       }
-
-      // If done braking, go to the next maneuver if there is one or stop the drive
-      if (millis() > driveStateTime + brakeTime) {
-        if (driveManeuverIndex < nDriveManeuvers - 1) {
-          driveManeuverIndex++;
-          changeState(driveManeuvers[driveManeuverIndex].state);
-        } else {
-          changeState(STOP);
-        }
-      }
+      break;                                                                                // brakeDone moves on once driveBrakeTimer runs out
   }
 }
 
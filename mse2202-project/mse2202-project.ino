@@ -61,44 +61,180 @@ const int ciMotorClimbB = 25;
 
 #include "drive.h"
 #include "climb.h"
+#include "calibrate.h"
 #include "MyWEBserver.h"
 #include "BreakPoint.h"
 #include "WDT.h";
+#include "Tunables.h"
 
 boolean btToggle = true;
-int curButtonState;
-int prevButtonState = HIGH;
+
+const unsigned long buttonDebounceTime = 50;    // Presses of PB1 closer together than this are switch bounce
+volatile unsigned long buttonPressTime = 0;     // Time of the last accepted PB1 press
+volatile uint32_t buttonPressCycles = 0;        // CPU cycle count of the last accepted PB1 press, for measuring the wake up latency
+
+// Execution time profile stages for the main loop, see "Profiler.h"
+unsigned char prfButtonWake;
+unsigned char prfTimers;
+unsigned char prfEncAveraging;
+unsigned char prfPrint;
+unsigned char prfDrive;
+unsigned char prfClimb;
+
+// Main loop stages, the core 1 watchdog records an overrun against the stage that was running (see "WDT.h")
+enum loopStage {
+  STAGE_TIMERS = 0,
+  STAGE_ENC_AVERAGING,
+  STAGE_BUTTON,
+  STAGE_PRINT,
+  STAGE_DRIVE,
+  STAGE_CLIMB,
+  STAGE_TUNABLES,
+  STAGE_TELEMETRY
+};
+const char *stageNames[] = {"TMR_Service", "ENC_Averaging", "Button", "Serial prints", "handleDrive", "handleClimb", "TUN_Service", "Telemetry"};
+
+// Feed the core 1 watchdog for the stage that just finished and mark the next one as running
+void startStage(loopStage stage) {
+  WDT_ResetCore1();
+  WDT_ucCaseIndexCore1 = stage;
+}
+
+// PB1 press interrupt, wakes the main loop straight away
+void IRAM_ATTR buttonISR() {
+  unsigned long now = millis();
+
+  if (now - buttonPressTime < buttonDebounceTime)
+    return;
+  buttonPressTime = now;
+  asm volatile("esync; rsr %0,ccount":"=a" (buttonPressCycles)); // @ 240mHz clock each tick is ~4nS
+  EVT_PostFromISR(EVT_BUTTON);
+}
+
+// Snapshot the control variables for the web page on core 0
+void publishTelemetry(void) {
+  TEL_Snapshot snapshot;
+
+  snapshot.u32Time = millis();
+  snapshot.iError1 = error1;
+  snapshot.i32LeftOdometer = ENC_vi32LeftOdometer;
+  snapshot.i32RightOdometer = ENC_vi32RightOdometer;
+  snapshot.ui16LeftEncoderAMissed = ENC_vui16LeftEncoderAMissed;
+  snapshot.ui16LeftEncoderBMissed = ENC_vui16LeftEncoderBMissed;
+  snapshot.ui16RightEncoderAMissed = ENC_vui16RightEncoderAMissed;
+  snapshot.ui16RightEncoderBMissed = ENC_vui16RightEncoderBMissed;
+  snapshot.u32LeftEncoderAveTime = ENC_ui32LeftEncoderAveTime;
+  snapshot.u32RightEncoderAveTime = ENC_ui32RightEncoderAveTime;
+  TEL_Publish(snapshot);
+}
 
 void setup() {
   Serial.begin(115200);
 
+  // Print the post mortem log from before this reset and record the reset reason
+  PM_Init();
+
+  // Interrupts post events to this task, has to be set before any are attached
+  EVT_Init();
+  TMR_Init();
+
+  // Allocate the GPIO interrupt on ENC_ISR_CORE before the first attachInterrupt, see "Encoder.h"
+  ENC_InstallISRService();
+
   Core_ZEROInit();
   Core_ONEInit();
 
+  // Load the stored calibrations (an ignored incomplete commit still leaves the values before it)
+  bool nvsValid = (NVS_Init() & (NVS_ERROR_PARTITION | NVS_ERROR_EMPTY)) == 0;
+  TUN_Init(nvsValid);   // Gains and timings changed from the web page
+  ENC_LoadCalibration(encToRotRatio / rotToCMRatio, toDouble(wheelGap));   // Per wheel ticks/cm and wheelbase, see "calibrate.h"
+
   // Setup for drive and climb pin modes, LEDC channels
   setupDrive();
-  setupClimb();
+  setupClimb(nvsValid);
+
+  // Encoder interrupts on ENC_ISR_CORE (the control core), away from the WiFi and web server on core 0
+  ENC_Init();
   
   pinMode(ciPB1, INPUT_PULLUP);
+  attachInterrupt(ciPB1, buttonISR, FALLING);
+
+  prfButtonWake = PRF_Register("PB1 wake up");
+  prfTimers = PRF_Register("TMR_Service");
+  prfEncAveraging = PRF_Register("ENC_Averaging");
+  prfPrint = PRF_Register("Serial prints");
+  prfDrive = PRF_Register("handleDrive");
+  prfClimb = PRF_Register("handleClimb");
+
+  for (int stage = STAGE_TIMERS; stage <= STAGE_TELEMETRY; stage++) {
+    WDT_pstrCaseNameCore1[stage] = stageNames[stage];
+  }
+  WDT_ResumeCore1();    // Setup takes longer than the core 1 watchdog, don't count it as an overrun
 }
 
 void loop() {
-  curButtonState = digitalRead(ciPB1);
+  // Sleep until an interrupt posts an event or a timer is due, or for one tick (1 mS) if the drive or climb is running
+  bool active = driveActive() || climbActive() || calibrationActive();
+  TickType_t timeout = active ? 1 : portMAX_DELAY;
+  SUP_Enable(active);             // The deadline supervisor only watches the loop while the motors can be running
+  NVS_AllowErase(!active);        // NVS compactions erase flash, which stalls both cores, so only while stopped
+  TMR_ScheduleWake();
+  WDT_ResetCore1();               // Feed for the end of the last pass, the watchdog doesn't run while asleep
+  WDT_SuspendCore1();
+  uint32_t events = EVT_Wait(timeout);
+  WDT_ResumeCore1();
+  SUP_CheckIn();
+
+  uint32_t prfMark = PRF_Now();   // Start of the current profile stage
+
+  if (SUP_Tripped()) {            // The supervisor cut the motors because this loop missed its deadlines, the motor writers
+                                  // skipped every write since, acknowledge it and stop everything
+    changeState(STOP);
+    stopClimb();
+    changeCalState(CAL_IDLE);
+  }
+
+  // Run the state machine timeouts that have expired
+  startStage(STAGE_TIMERS);
+  TMR_Service(micros());
+  if (events & EVT_LIMIT_SWITCH_EDGE)
+    restartLimitSwitchDebounce();   // The limit switch ISR can't touch the timer itself
+  PRF_Lap(prfTimers, prfMark);
   
   // Average the encoder tick times
+  startStage(STAGE_ENC_AVERAGING);
   ENC_Averaging();
+  PRF_Lap(prfEncAveraging, prfMark);
 
-  if (curButtonState == LOW && prevButtonState == HIGH) {   // Rising edge of PB1 press (as soon as it's pressed)
-    toggleDrive();  // Stop the drive if its on, start if its off
+  startStage(STAGE_BUTTON);
+  if (events & EVT_BUTTON) {   // PB1 pressed
+    PRF_Record(prfButtonWake, prfMark - buttonPressCycles);
+    if (curCalState != CAL_IDLE)
+      changeCalState(CAL_IDLE);   // Stop a calibration run
+    else
+      toggleDrive();  // Stop the drive if its on, start if its off
     stopClimb();    // Stop the climb if it's running
   }
 
-  handleDrive();          // Handle drive state machine (non-blocking)
-  if (readyToClimb()) {   // Determine whether the robot is ready to start climbing (on last drive maneuver)
-    startClimb();         // Switch the climb state to go up
+  startStage(STAGE_PRINT);
+  printDriveMeasurements(); // Print drive measurement variables during and just after a movement
+  PRF_Lap(prfPrint, prfMark);
+
+  startStage(STAGE_DRIVE);
+  handleCalibration();    // Odometry calibration runs, the drive state machine is held while one is going
+  if (curCalState == CAL_IDLE)
+    handleDrive();        // Handle drive state machine (non-blocking)
+  if (readyToClimb() && curClimbState == STOPPED) {   // Determine whether the robot is ready to start climbing (on last drive maneuver)
+    startClimb();                                     // Switch the climb state to go up
   }
+  PRF_Lap(prfDrive, prfMark);
+  startStage(STAGE_CLIMB);
   handleClimb();          // Handle climb state machine (non-blocking)
+  PRF_Lap(prfClimb, prfMark);
+
+  startStage(STAGE_TUNABLES);
+  TUN_Service();                  // Apply gains changed from the web page and queue them for NVS
 
-  prevButtonState = curButtonState;
-  delay(1);
+  startStage(STAGE_TELEMETRY);
+  publishTelemetry();     // Send this pass's control variables to core 0 for the web page
 }
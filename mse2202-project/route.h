@@ -0,0 +1,63 @@
+#ifndef ROUTE_H
+#define ROUTE_H 1
+
+#include "tuning.h"
+#include "util.h"
+
+/*
+ * The navigation route in "tuning.h" compiled into nominal encoder tick targets by the compiler
+ * The route is checked at build time, an invalid maneuver is a compile error instead of a robot that drives off
+ * When a maneuver starts its target is scaled by the odometry calibration with one fixed point multiply (routeTarget)
+ */
+
+const int nDriveManeuvers = sizeof(driveManeuvers) / sizeof(driveManeuver);     // Number of drive maneuvers declared in "tuning.h"
+constexpr Centimeters maxDriveDistance = 500_cm;   // Longest DRIVE maneuver
+constexpr Ticks minTargetTicks = 5_ticks;          // driveTo stops within 5 ticks of its target, a shorter maneuver would end as soon as it starts
+
+struct routeManeuver {
+  driveState state;
+  Ticks ticks;                      // Nominal encoder ticks, average of both wheels
+};
+
+constexpr Ticks nominalTicks(driveManeuver maneuver) {
+  return maneuver.state == DRIVE ? toTicks(maneuver.distance) : toTicks(maneuver.angle);
+}
+
+// Only forward drives and turns in the cwNavigation direction are supported by driveTo and turnTo
+constexpr bool validManeuver(driveManeuver maneuver) {
+  return ((maneuver.state == DRIVE && maneuver.distance > 0_cm && maneuver.distance <= maxDriveDistance) ||
+          (maneuver.state == TURN && maneuver.angle > 0_deg && maneuver.angle <= 360_deg)) &&
+         nominalTicks(maneuver) >= minTargetTicks;
+}
+
+constexpr bool validRoute(int index) {
+  return index >= nDriveManeuvers || (validManeuver(driveManeuvers[index]) && validRoute(index + 1));
+}
+
+static_assert(nDriveManeuvers > 0, "The route needs at least one maneuver");
+static_assert(validRoute(0), "Every maneuver must DRIVE 1 to maxDriveDistance cm or TURN 1 to 360 degrees, and be at least minTargetTicks long");
+
+// Compile time list of the route indexes, to build the table in one constant expression
+template <int... indexes> struct routeIndexes {};
+template <int n, int... indexes> struct makeRouteIndexes : makeRouteIndexes<n - 1, n - 1, indexes...> {};
+template <int... indexes> struct makeRouteIndexes<0, indexes...> {
+  typedef routeIndexes<indexes...> type;
+};
+
+template <int n> struct compiledRoute {
+  routeManeuver maneuvers[n];
+};
+
+template <int... indexes> constexpr compiledRoute<sizeof...(indexes)> compileRoute(routeIndexes<indexes...>) {
+  return {{{driveManeuvers[indexes].state, nominalTicks(driveManeuvers[indexes])}...}};
+}
+
+constexpr compiledRoute<nDriveManeuvers> route = compileRoute(makeRouteIndexes<nDriveManeuvers>::type());
+
+// Calibrated encoder target of a maneuver, call updateOdometryScales first
+Ticks routeTarget(int index) {
+  const routeManeuver &maneuver = route.maneuvers[index];
+  return {fixedMul(maneuver.ticks.raw, maneuver.state == DRIVE ? driveScale : turnScale)};
+}
+
+#endif
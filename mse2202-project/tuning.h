@@ -1,6 +1,8 @@
 #ifndef TUNING_H
 #define TUNING_H 1
 
+#include "Units.h"
+
 enum driveState {
   STOP = 0,
   DRIVE,
@@ -10,41 +12,58 @@ enum driveState {
 
 struct driveManeuver {
   driveState state;
-  int target;
+  Centimeters distance;   // DRIVE
+  Degrees angle;          // TURN
 };
 
-// Navigation Route
-const driveManeuver driveManeuvers[] = {
-  {DRIVE, 26},
-  {TURN, 95},
-  {DRIVE, 33},
-  {TURN, 90},
-  {DRIVE, 45}
+constexpr driveManeuver driveStraight(Centimeters distance) {
+  return {DRIVE, distance, 0_deg};
+}
+
+constexpr driveManeuver turnBy(Degrees angle) {
+  return {TURN, 0_cm, angle};
+}
+
+// Navigation Route (compiled into encoder targets and checked at build time, see "route.h")
+constexpr driveManeuver driveManeuvers[] = {
+  driveStraight(26_cm),
+  turnBy(95_deg),
+  driveStraight(33_cm),
+  turnBy(90_deg),
+  driveStraight(45_cm)
 };
 
 const bool cwNavigation = true;                           // True if the robot's navigation and turns are clockwise
 
 // Robot Constants
-const double wheelDiameter = 4.3;                         // Wheel's diameter from center to edge of rubber
-const double wheelGap = 9.4;                              // Gap between wheels from center to center
+constexpr Centimeters wheelDiameter = 4.3_cm;             // Wheel's diameter from center to edge of rubber
+constexpr Centimeters wheelGap = 9.4_cm;                  // Gap between wheels from center to center
+
+constexpr int encToRotRatio = 60;                         // Number of encoder ticks for one rotation of the wheel
+constexpr double rotToCMRatio = toDouble(wheelDiameter) * 3.14159;   // Ratio between rotations to centimeters using the wheel diameter
+// These are nominal, the per wheel ticks/cm and the wheelbase used for driving are calibrated (see "calibrate.h")
 
-const int encToRotRatio = 60;                             // Number of encoder ticks for one rotation of the wheel
-const double rotToCMRatio = wheelDiameter * 3.14159;      // Ratio between rotations to centimeters using the wheel diameter
+// Odometry Calibration Constants
+constexpr Centimeters calStraightDistance = 100_cm;       // Nominal length of the calibration straight run
+constexpr Degrees calSpinAngle = 720_deg;                 // Nominal angle of the calibration spin test
+const int calPower = 180;                                 // Drive power during the calibration runs
+const double calSteerkP = 4;                              // Keeps the wheels' ticks equal during the straight run
+const unsigned long calSettleTime = 500;                  // Time for the robot to roll to a stop before the ticks are counted
 
-// General Tuning Constants
+// General Tuning Constants (the non-const ones can be changed from the web page, see "Tunables.h")
 const int driveMaxPower = 255;                            // Maximum power of the drive
 int brakePower = 25;                                      // Braking power (applied opposite of the direction of movement)
 unsigned long brakeTime = 80;                             // Time to apply the braking power for
 
 // Drive (Straight) Tuning Constants
-const double drivekP = 6.5;                               // Constant of proportionality for driving forwards/backwards
-const double drivekI = 3.5;                               // Constant of integration for driving forwards/backwards
-const double driveSteerkP = -6.7;                         // Constant of proportionality for correcting the drive's steering to straight
-const double driveAccelTime = 500;                        // Time to accelerate from 0 to 255 power
+double drivekP = 6.5;                                     // Constant of proportionality for driving forwards/backwards
+double drivekI = 3.5;                                     // Constant of integration for driving forwards/backwards
+double driveSteerkP = -6.7;                               // Constant of proportionality for correcting the drive's steering to straight
+double driveAccelTime = 500;                              // Time to accelerate from 0 to 255 power
 
 // Turn Tuning Constants
-const double turnkP = 6.9;                                // Constant of proportionality for tank turning
-const double turnkI = 15.5;                               // Constant of integration for tank turning
-const double turnAccelTime = 300;                         // Time to accelerate from 0 to 255 power
+double turnkP = 6.9;                                      // Constant of proportionality for tank turning
+double turnkI = 15.5;                                     // Constant of integration for tank turning
+double turnAccelTime = 300;                               // Time to accelerate from 0 to 255 power
 
 #endif
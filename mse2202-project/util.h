@@ -8,14 +8,45 @@ template <typename T> int sgn(T val) {
     return (T(0) < val) - (val < T(0));
 }
 
-// Convert centimeters to the necessary encoder ticks
-int cmToEnc(double cm) {
-  return cm / rotToCMRatio * encToRotRatio;
+// Nominal encoder ticks per centimeter from the wheel size, and per degree of tank turn from the wheel gap (see "Units.h")
+constexpr tickRatio<centimeterTag, 8> ticksPerCm = makeTickRatio<centimeterTag, 8>(encToRotRatio / rotToCMRatio);
+constexpr tickRatio<degreeTag, 8> ticksPerDegree = makeTickRatio<degreeTag, 8>(toDouble(wheelGap) * 3.14159 / 360 * encToRotRatio / rotToCMRatio);
+
+// Convert centimeters to the necessary encoder ticks, nominal (the route is converted at build time, see "route.h")
+constexpr Ticks toTicks(Centimeters distance) {
+  return toTicks(distance, ticksPerCm);
+}
+
+// Convert angle to the necessary encoder ticks for each wheel (for robot to tank turn to), nominal
+constexpr Ticks toTicks(Degrees angle) {
+  return toTicks(angle, ticksPerDegree);
+}
+
+// 16.16 fixed point, so the control loop doesn't need floating point (the ESP32 has no double FPU)
+int32_t toFixed(double value) {
+  return lround(value * 65536);
+}
+
+int32_t fixedMul(int32_t value, int32_t fixed) {
+  return ((int64_t)value * fixed) >> 16;
+}
+
+// Odometry calibration (ENC_Calibrate in "Encoder.h") as fixed point scales from the nominal ticks
+int32_t driveScale = 65536;         // Calibrated / nominal ticks per cm
+int32_t turnScale = 65536;          // Calibrated / nominal ticks per degree of tank turn
+int32_t rightToLeftScale = 65536;   // Left / right wheel ticks per cm
+
+// Work out the scales from the current calibration, once when a maneuver starts rather than every pass
+void updateOdometryScales(void) {
+  double ticksPerCm = (ENC_dLeftTicksPerCm + ENC_dRightTicksPerCm) / 2;
+  driveScale = toFixed(ticksPerCm / ENC_dNominalTicksPerCm);
+  turnScale = toFixed(ticksPerCm * ENC_dWheelbase / (ENC_dNominalTicksPerCm * ENC_dNominalWheelbase));
+  rightToLeftScale = toFixed(ENC_dLeftTicksPerCm / ENC_dRightTicksPerCm);
 }
 
-// Convert angle to the necessary encoder ticks (for robot to tank turn to)
-int degTurnToEnc(double deg) {
-  return (wheelGap * 3.14159) / rotToCMRatio * encToRotRatio * (deg / 360);
+// Right encoder ticks scaled to the left wheel's ticks per cm, so equal values mean equal distances
+int rightEncAsLeft(int ticks) {
+  return fixedMul(ticks, rightToLeftScale);
 }
 
 #endif
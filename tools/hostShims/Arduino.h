@@ -0,0 +1,84 @@
+// Just enough of the Arduino core and ESP-IDF for the storage, timer and event headers to build on the host, see the tools
+// scripts in the folder above. Not a general replacement, add what a new tool needs
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H 1
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <climits>
+#include <chrono>
+#include <algorithm>
+
+typedef bool boolean;
+using std::min;
+using std::max;
+
+struct HostSerial {
+  void print(const char *text) { fputs(text, stdout); }
+  void println(const char *text = "") { puts(text); }
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+};
+static HostSerial Serial __attribute__((unused));
+
+// Arduino's random: 0 to max - 1, 0 when max is 0, seeded with srandom() so a run can be repeated
+inline long random(long maxValue) {
+  return maxValue <= 0 ? 0 : ::random() % maxValue;
+}
+inline long random(long minValue, long maxValue) {
+  return minValue >= maxValue ? minValue : minValue + ::random() % (maxValue - minValue);
+}
+
+// a tool that steps time itself defines HOST_MANUAL_CLOCK before including this and sets hostMicros
+#ifdef HOST_MANUAL_CLOCK
+static uint32_t hostMicros;
+inline uint32_t micros() {
+  return hostMicros;
+}
+#else
+inline uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+inline uint32_t millis() {
+  return micros() / 1000;
+}
+
+// FreeRTOS, single threaded: critical sections do nothing and there is never a task to wait for
+typedef void *TaskHandle_t;
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux)
+#define pdTRUE 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdMS_TO_TICKS(ms) (ms)
+inline void xTaskCreatePinnedToCore(void (*task)(void *), const char *, uint32_t, void *, int, TaskHandle_t *handle, int) {
+  *handle = (TaskHandle_t)task;
+}
+inline uint32_t ulTaskNotifyTake(int, uint32_t) { return 0; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline void vTaskDelay(uint32_t) {}
+
+// task notifications for "Events.h", there is no control task so posts go nowhere
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+enum eNotifyAction { eSetBits };
+#define pdFALSE 0
+#define IRAM_ATTR
+#define portYIELD_FROM_ISR()
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+inline void xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction) {}
+inline void xTaskNotifyFromISR(TaskHandle_t, uint32_t, eNotifyAction, BaseType_t *) {}
+inline void xTaskNotifyWait(uint32_t, uint32_t, uint32_t *, TickType_t) {}
+
+#endif
@@ -0,0 +1,22 @@
+// Host stand in for the ESP-IDF partition API: no partitions, the storage tools install their own flash backend
+
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H 1
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_PARTITION_TYPE_DATA 1
+#define ESP_PARTITION_SUBTYPE_ANY 0xFF
+
+struct esp_partition_t {
+  uint32_t size;
+};
+
+inline const esp_partition_t *esp_partition_find_first(int, int, const char *) { return nullptr; }
+inline esp_err_t esp_partition_read(const esp_partition_t *, size_t, void *, size_t) { return ESP_FAIL; }
+inline esp_err_t esp_partition_write(const esp_partition_t *, size_t, const void *, size_t) { return ESP_FAIL; }
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *, size_t, size_t) { return ESP_FAIL; }
+
+#endif
@@ -0,0 +1,33 @@
+// One shot esp_timer for "TimerWheel.h" on the host: nothing runs the callback, the tool reads when it would have fired
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H 1
+
+#include <cstdint>
+
+typedef void *esp_timer_handle_t;
+
+struct esp_timer_create_args_t {
+  void (*callback)(void *);
+  void *arg;
+  const char *name;
+};
+
+static bool hostTimerStarted;      // esp_timer_start_once called since the last stop
+static uint64_t hostTimerTimeout;  // its timeout in uS
+
+inline int esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t *handle) {
+  *handle = (esp_timer_handle_t)&hostTimerStarted;
+  return 0;
+}
+inline int esp_timer_stop(esp_timer_handle_t) {
+  hostTimerStarted = false;
+  return 0;
+}
+inline int esp_timer_start_once(esp_timer_handle_t, uint64_t timeout) {
+  hostTimerStarted = true;
+  hostTimerTimeout = timeout;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,17 @@
+// Host version of the ESP32 ROM's little endian CRC32 (the same polynomial and conventions as crc32_le in ROM)
+
+#ifndef HOST_ROM_CRC_H
+#define HOST_ROM_CRC_H 1
+
+inline uint32_t crc32_le(uint32_t crc, const uint8_t *buffer, uint32_t length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *buffer++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+#endif
@@ -0,0 +1,17 @@
+// Host build of the NVS power loss test in "NVSFlashSim.h": the real "NVS.h" on emulated flash, compiled with g++ against
+// the shims in hostShims, see nvsSim.sh
+// usage: nvsSim [boots] [seed], exits 1 if any emulated boot came up with values that were never committed
+
+#include "hostShims/Arduino.h"
+
+#define NVS_FLASH_SIM 1
+#include "../mse2202-project/NVS.h"
+
+int main(int argc, char **argv) {
+  unsigned int boots = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+  unsigned int seed = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1;
+
+  srandom(seed);
+  printf("seed %u\n", seed);
+  return NVS_SIM_Run(boots) == 0 ? 0 : 1;
+}
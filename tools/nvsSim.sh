@@ -0,0 +1,15 @@
+#!/bin/sh
+# Build and run the NVS power loss test on the host, see "NVSFlashSim.h"
+# usage: tools/nvsSim.sh [boots] [seed]     (20000 boots, seed 1 by default)
+# the counts are the same for the same boots and seed, the uS times are the host's CPU plus the modelled flash
+# exits 1 if the build fails or any boot came up inconsistent
+
+CXX=${CXX:-g++}
+DIR=$(dirname "$0")
+BIN=${TMPDIR:-/tmp}/nvsSim
+
+$CXX -std=gnu++11 -O2 -Wall -Wno-unused-function -I "$DIR/hostShims" "$DIR/nvsSim.cpp" -o "$BIN" || exit 1
+"$BIN" "$@"
+status=$?
+rm -f "$BIN"
+exit $status
@@ -0,0 +1,151 @@
+// Reference model fuzz test of "TimerWheel.h": the real wheel compiled with g++ against the shims in hostShims, with
+// micros() stepped by the test, see timerWheel.sh
+// usage: timerWheel [steps] [seed], exits 1 if a timer fired that wasn't armed, fired early, or was still armed after
+// the control task would have been woken past its expiry
+//
+// the model is the expiry of each timer and whether it is armed; the control task is modelled as sleeping until the
+// wake TMR_ScheduleWake asked for, or less, so a cascade or jump that loses a timer or schedules its wake too late
+// shows up as a late timer
+
+#define HOST_MANUAL_CLOCK 1
+#include "hostShims/Arduino.h"
+#include "../mse2202-project/TimerWheel.h"
+
+const int numTimers = 20;
+
+TMR_Timer timers[numTimers];
+uint32_t modelExpiry[numTimers];
+bool modelArmed[numTimers];
+unsigned long failures;
+unsigned long fired;
+
+static void fail(const char *what, int timer, int32_t by) {
+  if (failures++ < 10) {
+    printf("at %08x timer %d %s by %d uS\n", (unsigned int)hostMicros, timer, what, (int)by);
+  }
+}
+
+static void arm(int timer, uint32_t delay) {
+  TMR_Arm(&timers[timer], delay);
+  modelExpiry[timer] = hostMicros + delay;
+  modelArmed[timer] = true;
+}
+
+// callbacks take no argument, so one instance per timer; a third of them arm another timer the way the state machines do
+template <int timer> void expired() {
+  fired++;
+  if (!modelArmed[timer]) {
+    fail("fired while not armed", timer, 0);
+  } else if ((int32_t)(hostMicros - modelExpiry[timer]) < 0) {
+    fail("fired early", timer, modelExpiry[timer] - hostMicros);
+  }
+  modelArmed[timer] = false;
+  if (random(3) == 0) {
+    arm(random(numTimers), 1 + random(2000000));
+  }
+}
+
+template <int timer> struct Callbacks {
+  static void init() {
+    timers[timer] = TMR_TIMER(expired<timer>);
+    Callbacks<timer + 1>::init();
+  }
+};
+template <> struct Callbacks<numTimers> {
+  static void init() {}
+};
+
+// one control task pass: service at the new time, the wheel must end up just past now, and no timer may be overdue
+static void service() {
+  TMR_Service(hostMicros);
+  if (TMR_u32WheelTime != hostMicros + 1) {
+    fail("wheel time behind or ahead of now", -1, TMR_u32WheelTime - (hostMicros + 1));
+  }
+  for (int timer = 0; timer < numTimers; timer++) {
+    if (modelArmed[timer] && (int32_t)(hostMicros - modelExpiry[timer]) >= 0) {
+      fail("late", timer, hostMicros - modelExpiry[timer]);
+      modelArmed[timer] = false;
+      TMR_Cancel(&timers[timer]);
+    }
+    if (modelArmed[timer] != (bool)TMR_IsArmed(&timers[timer])) {
+      fail("armed differs from the model", timer, 0);
+      modelArmed[timer] = TMR_IsArmed(&timers[timer]);
+    }
+  }
+  TMR_ScheduleWake();
+}
+
+// sleep for up to sleepFor uS, or less if the wake timer goes off first
+static void sleep(uint32_t sleepFor) {
+  if (hostTimerStarted && hostTimerTimeout < sleepFor) {
+    sleepFor = hostTimerTimeout;
+  }
+  hostMicros += sleepFor;
+}
+
+static void fuzz(unsigned long steps) {
+  for (unsigned long step = 0; step < steps; step++) {
+    int action = random(100);
+    if (action < 10) {
+      // a quarter of the arms are past the last level (67S) and get parked
+      arm(random(numTimers), random(4) == 0 ? random(200000000) : random(300000));
+    } else if (action < 13) {
+      int timer = random(numTimers);
+      TMR_Cancel(&timers[timer]);
+      modelArmed[timer] = false;
+    }
+    TMR_ScheduleWake();
+
+    // mostly a pass every few mS, 1 in 1000 an idle spell of up to 28 minutes, half of them also past 2^31 uS
+    if (random(1000) == 0) {
+      sleep((uint32_t)random(2) * 0x90000000UL + random(100000000));
+    } else {
+      sleep(random(2000));
+    }
+    service();
+  }
+}
+
+// the idle cases the wheel was fixed for: the wheel has to be at now after any idle spell, and timers armed afterwards
+// fire on time
+static void idle() {
+  unsigned long passes = 0;
+
+  hostMicros += 600000000UL;   // 10 minutes with nothing armed
+  service();
+  hostMicros += 0xA0000000UL;  // 45 minutes, past the sign of a 32 bit difference
+  arm(0, 300000);
+  service();
+  hostMicros += 299999;
+  service();
+  hostMicros += 1;
+  service();
+  if (modelArmed[0]) {
+    fail("300mS timer after 45 minutes idle not fired", 0, 0);
+  }
+
+  arm(1, 60000000);            // 60S timer, serviced every 1mS
+  while (modelArmed[1] && passes < 70000) {
+    hostMicros += 1000;
+    passes++;
+    service();
+  }
+  if (passes != 60000) {
+    fail("60S timer not fired after 60000 1mS passes", 1, (passes - 60000) * 1000);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long steps = argc > 1 ? strtoul(argv[1], nullptr, 0) : 2000000;
+  unsigned int seed = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1;
+
+  srandom(seed);
+  Callbacks<0>::init();
+  hostMicros = 0xFFFF0000UL;   // micros() wraps 65mS in
+  TMR_Init();
+  idle();
+  printf("idle cases: %lu failures\n", failures);
+  fuzz(steps);
+  printf("seed %u, %lu steps, %lu callbacks, %lu failures\n", seed, steps, fired, failures);
+  return failures == 0 ? 0 : 1;
+}
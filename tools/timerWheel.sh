@@ -0,0 +1,15 @@
+#!/bin/sh
+# Build and run the timer wheel reference model fuzz test on the host, see timerWheel.cpp
+# usage: tools/timerWheel.sh [steps] [seed]     (2000000 steps, seed 1 by default)
+# the same steps and seed give the same run
+# exits 1 if the build fails or any timer fired early, late or when it was not armed
+
+CXX=${CXX:-g++}
+DIR=$(dirname "$0")
+BIN=${TMPDIR:-/tmp}/timerWheel
+
+$CXX -std=gnu++11 -O2 -Wall -Wno-unused-function -I "$DIR/hostShims" "$DIR/timerWheel.cpp" -o "$BIN" || exit 1
+"$BIN" "$@"
+status=$?
+rm -f "$BIN"
+exit $status
@@ -0,0 +1,43 @@
+// Host check that the unit types in "Units.h" cost nothing: each typed function below has a hand written twin on bare
+// int32_t, and unitsCheck.sh compiles this file and compares their disassembly instruction for instruction
+// Not part of the sketch, the Arduino build never sees this folder
+
+#include <cstdint>
+#include "../mse2202-project/tuning.h"
+
+// The ratios from "util.h", which also pulls in the encoder globals
+constexpr tickRatio<centimeterTag, 8> ticksPerCm = makeTickRatio<centimeterTag, 8>(encToRotRatio / rotToCMRatio);
+constexpr tickRatio<degreeTag, 8> ticksPerDegree = makeTickRatio<degreeTag, 8>(toDouble(wheelGap) * 3.14159 / 360 * encToRotRatio / rotToCMRatio);
+
+// Drive error, target minus the average of both encoders
+extern "C" int32_t typedError(int32_t left, int32_t right, int32_t target) {
+  Ticks average{(left + right) / 2};
+  return (Ticks{target} - average).raw;
+}
+extern "C" int32_t handError(int32_t left, int32_t right, int32_t target) {
+  return target - (left + right) / 2;
+}
+
+// Target reached check
+extern "C" bool typedReached(int32_t position, int32_t target) {
+  return Ticks{position} >= Ticks{target};
+}
+extern "C" bool handReached(int32_t position, int32_t target) {
+  return position >= target;
+}
+
+// Centimeters (8 fraction bits) to ticks with the 16.16 ratio from "util.h"
+extern "C" int32_t typedToTicks(int32_t centimeters) {
+  return toTicks(Centimeters{centimeters}, ticksPerCm).raw;
+}
+extern "C" int32_t handToTicks(int32_t centimeters) {
+  return (int32_t)(((int64_t)centimeters * ticksPerCm.perUnit + (1LL << 23)) >> 24);
+}
+
+// Degrees to ticks, same as above with the tank turn ratio
+extern "C" int32_t typedTurnTicks(int32_t degrees) {
+  return toTicks(Degrees{degrees}, ticksPerDegree).raw;
+}
+extern "C" int32_t handTurnTicks(int32_t degrees) {
+  return (int32_t)(((int64_t)degrees * ticksPerDegree.perUnit + (1LL << 23)) >> 24);
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Compare the disassembly of the typed and hand written functions in unitsCheck.cpp, see "Units.h"
+# usage: tools/unitsCheck.sh           (host g++)
+#        CXX=xtensa-esp32-elf-g++ OBJDUMP=xtensa-esp32-elf-objdump tools/unitsCheck.sh
+# prints each pair, exits 1 if a typed function is longer than its twin or calls anything
+# the compiler may still pick a different register order for the same instructions (a commuted compare), that is shown
+# as a diff but passes
+
+CXX=${CXX:-g++}
+OBJDUMP=${OBJDUMP:-objdump}
+DIR=$(dirname "$0")
+OBJ=${TMPDIR:-/tmp}/unitsCheck.o
+
+$CXX -std=gnu++11 -Os -c "$DIR/unitsCheck.cpp" -o "$OBJ" || exit 1
+
+# instructions of one function, without addresses or encodings
+body() {
+  $OBJDUMP -d --no-show-raw-insn "$OBJ" | awk -v f="<$1>:" '$2 == f { on = 1; next } /^$/ { on = 0 } on && !/nop/ { sub(/^ *[0-9a-f]+:[ \t]*/, ""); print }'
+}
+
+status=0
+for name in Error Reached ToTicks TurnTicks; do
+  body typed$name > "$OBJ.typed"
+  body hand$name > "$OBJ.hand"
+  typed=$(wc -l < "$OBJ.typed")
+  hand=$(wc -l < "$OBJ.hand")
+  if cmp -s "$OBJ.typed" "$OBJ.hand"; then
+    echo "$name: same ($typed instructions)"
+  elif [ "$typed" -le "$hand" ] && ! grep -q call "$OBJ.typed"; then
+    echo "$name: $typed instructions against $hand, different registers or operand order"
+    diff "$OBJ.typed" "$OBJ.hand"
+  else
+    echo "$name: typed $typed instructions, hand written $hand"
+    diff "$OBJ.typed" "$OBJ.hand"
+    status=1
+  fi
+done
+rm -f "$OBJ" "$OBJ.typed" "$OBJ.hand"
+exit $status
@@ -0,0 +1,207 @@
+// Host round trip test of the watch variable delta coding: samples are encoded with WSVR_PackDelta from "WatchDelta.h"
+// into frames laid out like WSVR_BuildSampleFrame's ("BreakPoint.h"), watchDelta.js decodes them with the web page's own
+// getData and compares every decoded sample byte for byte, see watchDelta.sh
+// usage: watchDelta <output folder>, writes <stream>.types, <stream>.frames and <stream>.samples for each stream
+
+#include "hostShims/Arduino.h"
+#include <string>
+#include <vector>
+#include "../mse2202-project/WatchDelta.h"
+
+const int frameHeader = 8;
+const int maxFrame = 1400;
+
+struct stream {
+  std::string name;
+  std::string types;                // "TYP" section of the names message
+  std::vector<uint8_t> sizes;
+  size_t sampleSize;
+  std::vector<std::vector<uint8_t>> samples;
+};
+
+// Frames of 1 to 60 samples (the ring is 64), the first packed whole and the rest as deltas, returns the bytes written
+static size_t writeFrames(const stream &s, const char *folder) {
+  FILE *frames = fopen((std::string(folder) + "/" + s.name + ".frames").c_str(), "wb");
+  FILE *samples = fopen((std::string(folder) + "/" + s.name + ".samples").c_str(), "wb");
+  FILE *types = fopen((std::string(folder) + "/" + s.name + ".types").c_str(), "w");
+  const size_t maxDelta = 3 + s.sampleSize + s.sizes.size();
+  size_t next = 0;
+  size_t total = 0;
+  uint16_t sequence = 0;
+
+  fputs(s.types.c_str(), types);
+  while (next < s.samples.size()) {
+    uint8_t frame[maxFrame];
+    uint8_t *out = frame + frameHeader;
+    size_t wanted = random(1, 61);
+    uint32_t count = 1;
+    uint32_t time = next;
+
+    frame[0] = 2;
+    memcpy(&frame[2], &sequence, 2);
+    memcpy(&frame[4], &time, 4);
+    sequence++;
+    memcpy(out, s.samples[next].data(), s.sampleSize);
+    out += s.sampleSize;
+    next++;
+    while (next < s.samples.size() && count < wanted && out + maxDelta <= frame + maxFrame) {
+      out = WSVR_PackDelta(out, s.samples[next].data(), s.samples[next - 1].data(), s.sizes.data(), s.sizes.size());
+      next++;
+      count++;
+    }
+    frame[1] = count;
+
+    uint32_t length = out - frame;
+    fwrite(&length, 4, 1, frames);
+    fwrite(frame, 1, length, frames);
+    total += length;
+  }
+  for (const std::vector<uint8_t> &sample : s.samples) {
+    fwrite(sample.data(), 1, sample.size(), samples);
+  }
+  fclose(frames);
+  fclose(samples);
+  fclose(types);
+  return total;
+}
+
+template <typename T> static void put(std::vector<uint8_t> &sample, size_t offset, T value) {
+  memcpy(&sample[offset], &value, sizeof(T));
+}
+
+// Every width and sign, wrap arounds both ways, floats and the whole 8 byte path, then random changes
+static stream edgeCases() {
+  stream s;
+  s.name = "edges";
+  s.types = "u1;i1;u2;i2;u4;i4;f4;u8;i8;f8";
+  s.sizes = {1, 1, 2, 2, 4, 4, 4, 8, 8, 8};
+  s.sampleSize = 42;
+  const size_t offsets[] = {0, 1, 2, 4, 6, 10, 14, 18, 26, 34};
+
+  std::vector<uint8_t> sample(s.sampleSize, 0);
+  auto add = [&]() { s.samples.push_back(sample); };
+
+  add();                                            // all zero
+  add();                                            // nothing changed, mask 0
+  put<uint8_t>(sample, offsets[0], 0xFF);           // negative deltas, 0 - 1 in each width
+  put<int8_t>(sample, offsets[1], -1);
+  put<uint16_t>(sample, offsets[2], 0xFFFF);
+  put<int16_t>(sample, offsets[3], -1);
+  put<uint32_t>(sample, offsets[4], 0xFFFFFFFF);
+  put<int32_t>(sample, offsets[5], -1);
+  add();
+  put<uint8_t>(sample, offsets[0], 0x00);           // wrap up past the top of each width
+  put<int8_t>(sample, offsets[1], 127);
+  put<uint16_t>(sample, offsets[2], 0x0000);
+  put<int16_t>(sample, offsets[3], 32767);
+  put<uint32_t>(sample, offsets[4], 0);
+  put<int32_t>(sample, offsets[5], INT32_MAX);
+  add();
+  put<int8_t>(sample, offsets[1], -128);            // signed overflow, +1 wraps to the most negative
+  put<int16_t>(sample, offsets[3], -32768);
+  put<int32_t>(sample, offsets[5], INT32_MIN);
+  add();
+  put<int8_t>(sample, offsets[1], 127);             // and back, the largest differences each width can have
+  put<int16_t>(sample, offsets[3], 32767);
+  put<int32_t>(sample, offsets[5], INT32_MAX);
+  put<uint8_t>(sample, offsets[0], 0x80);
+  put<uint16_t>(sample, offsets[2], 0x8000);
+  put<uint32_t>(sample, offsets[4], 0x80000000);
+  add();
+  put<float>(sample, offsets[6], 1.5f);             // floats by bit pattern, including sign changes, inf and NaN
+  add();
+  put<float>(sample, offsets[6], -2.25f);
+  add();
+  put<float>(sample, offsets[6], INFINITY);
+  add();
+  put<float>(sample, offsets[6], NAN);
+  add();
+  put<uint64_t>(sample, offsets[7], 0xFFFFFFFFFFFFFFFFULL);   // wider than 4 bytes, sent whole
+  put<int64_t>(sample, offsets[8], INT64_MIN);
+  put<double>(sample, offsets[9], 3.141592653589793);
+  add();
+  put<double>(sample, offsets[9], -0.0);           // only the last variable, a 2 byte mask
+  add();
+
+  for (int i = 0; i < 20000; i++) {
+    for (size_t field = 0; field < s.sizes.size(); field++) {
+      int roll = random(10);
+      if (roll < 2) {                               // small step either way
+        uint64_t value = 0;
+        memcpy(&value, &sample[offsets[field]], s.sizes[field]);
+        value += random(-3, 4);
+        memcpy(&sample[offsets[field]], &value, s.sizes[field]);
+      } else if (roll < 3) {                        // anything at all
+        for (size_t byte = 0; byte < s.sizes[field]; byte++) {
+          sample[offsets[field] + byte] = random(256);
+        }
+      }
+    }
+    add();
+  }
+  return s;
+}
+
+// The current watch list in "BreakPoint.h" on a 1 kHz drive: a counter that steps every pass, a jittering error, and
+// odometers and encoder periods that update every ~7 passes (30 cm/s)
+static stream driveModel(size_t &textBytes) {
+  stream s;
+  s.name = "drive";
+  s.types = "u4;i4;i4;i4;u2;u2;u2;u2;u4;u4";
+  s.sizes = {4, 4, 4, 4, 2, 2, 2, 2, 4, 4};
+  s.sampleSize = 32;
+
+  uint32_t counter = 100000;
+  int32_t error = 0, right = 1000, left = 1000;
+  uint16_t missed[4] = {0, 0, 3, 0};
+  uint32_t leftTime = 7200, rightTime = 7300;
+  textBytes = 0;
+  for (int i = 0; i < 50000; i++) {
+    std::vector<uint8_t> sample(s.sampleSize);
+    counter++;
+    if (random(3) == 0) {
+      error += random(-3, 4);
+    }
+    if (random(7) == 0) {
+      right++;
+      rightTime = 7000 + random(600);
+    }
+    if (random(7) == 0) {
+      left++;
+      leftTime = 7000 + random(600);
+    }
+    put(sample, 0, counter);
+    put(sample, 4, error);
+    put(sample, 8, right);
+    put(sample, 12, left);
+    memcpy(&sample[16], missed, 8);
+    put(sample, 24, leftTime);
+    put(sample, 28, rightTime);
+    s.samples.push_back(sample);
+    // the "V#^;CC;...;END" text message the binary frames replaced, one per sample
+    textBytes += 10 + snprintf(nullptr, 0, "%u;%d;%d;%d;%u;%u;%u;%u;%u;%u;", counter, error, right, left, missed[0], missed[1],
+                               missed[2], missed[3], leftTime, rightTime);
+  }
+  return s;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: watchDelta <output folder>\n");
+    return 1;
+  }
+  srandom(1);
+
+  stream edges = edgeCases();
+  size_t edgeBytes = writeFrames(edges, argv[1]);
+  printf("edges: %zu samples of %zu bytes, %.2f bytes per sample sent\n", edges.samples.size(), edges.sampleSize,
+         (double)edgeBytes / edges.samples.size());
+
+  size_t textBytes;
+  stream drive = driveModel(textBytes);
+  size_t driveBytes = writeFrames(drive, argv[1]);
+  printf("drive: %zu samples of %zu bytes, %.2f bytes per sample sent, text %.2f, %.1fx smaller\n", drive.samples.size(),
+         drive.sampleSize, (double)driveBytes / drive.samples.size(), (double)textBytes / drive.samples.size(),
+         (double)textBytes / driveBytes);
+  return 0;
+}
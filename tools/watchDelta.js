@@ -0,0 +1,61 @@
+// Decode the frames written by watchDelta.cpp with the script of the web page in "BreakPointWEBPage.h" (its getData,
+// getDelta and getVarint, unchanged) and check every sample comes out byte for byte, see watchDelta.sh
+// usage: node watchDelta.js <page header> <folder>, exits 1 on any difference
+
+const fs = require("fs");
+const path = require("path");
+
+// just enough of a browser for the page script to load
+const element = () => ({innerHTML: "", style: {}});
+global.document = {
+  getElementById: () => ({getContext: () => ({moveTo() {}, beginPath() {}, lineTo() {}, stroke() {}, canvas: {width: 100, height: 100}})}),
+  getElementsByName: () => Array.from({length: 20}, element)
+};
+global.window = {innerWidth: 100, innerHeight: 300};
+global.location = {hostname: "localhost"};
+global.WebSocket = function () {};
+global.setInterval = () => {};
+
+const page = fs.readFileSync(process.argv[2], "utf8");
+const script = page.substring(page.indexOf("<script>") + "<script>".length, page.lastIndexOf("</script>"));
+
+let failed = false;
+(0, eval)(script);
+
+for (const name of ["edges", "drive"]) {
+  const folder = process.argv[3];
+  const types = fs.readFileSync(path.join(folder, name + ".types"), "utf8");
+  const frames = fs.readFileSync(path.join(folder, name + ".frames"));
+  const expected = fs.readFileSync(path.join(folder, name + ".samples"));
+
+  vWorkingData = ("N#^;DBON;CONT;BPN;CC;TYP;" + types + ";END").split(";");
+  getTypes();
+  const size = SampleView.byteLength;
+  let decoded = 0;
+  let mismatches = 0;
+  Chartting = function () {              // called once per decoded sample
+    for (let i = 0; i < size; i++) {
+      if (SampleView.getUint8(i) != expected[decoded * size + i]) {
+        if (mismatches < 5) {
+          console.log(name + " sample " + decoded + " byte " + i + ": " + SampleView.getUint8(i) + " expected " + expected[decoded * size + i]);
+        }
+        mismatches++;
+        break;
+      }
+    }
+    decoded++;
+  };
+
+  for (let offset = 0; offset < frames.length;) {
+    const length = frames.readUInt32LE(offset);
+    offset += 4;
+    getData(new DataView(frames.buffer.slice(frames.byteOffset + offset, frames.byteOffset + offset + length)));
+    offset += length;
+  }
+  const total = expected.length / size;
+  console.log(name + ": " + decoded + " of " + total + " samples decoded, " + mismatches + " different, " + FramesLost + " frames lost");
+  if (decoded != total || mismatches != 0 || FramesLost != 0) {
+    failed = true;
+  }
+}
+process.exit(failed ? 1 : 0);
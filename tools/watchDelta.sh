@@ -0,0 +1,16 @@
+#!/bin/sh
+# Round trip the watch variable delta coding: encode with "WatchDelta.h" (g++), decode with the web page's script (node)
+# usage: tools/watchDelta.sh
+# prints the bytes sent per sample (and against the old text message for the drive model), exits 1 on any difference
+
+CXX=${CXX:-g++}
+DIR=$(dirname "$0")
+OUT=${TMPDIR:-/tmp}/watchDelta
+
+mkdir -p "$OUT"
+$CXX -std=gnu++11 -O2 -Wall -I "$DIR/hostShims" "$DIR/watchDelta.cpp" -o "$OUT/watchDelta" || exit 1
+"$OUT/watchDelta" "$OUT" || exit 1
+node "$DIR/watchDelta.js" "$DIR/../mse2202-project/BreakPointWEBPage.h" "$OUT"
+status=$?
+rm -rf "$OUT"
+exit $status